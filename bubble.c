@@ -8,15 +8,27 @@
 #include <sunwindow/pixwin.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <math.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #define WINDOW_WIDTH 440
-#define WINDOW_HEIGHT 440
+#define WINDOW_HEIGHT 460
 #define BOARD_SIZE 11
 #define CELL_SIZE 40
 #define COLOR_COUNT 5
 #define NUM_COLORS 8
+#define CELLS (BOARD_SIZE * BOARD_SIZE)
+#define MAX_MOVES (CELLS / 2 + 1)
+#define DEFAULT_BEAM 200
+#define DEFAULT_JOBS 1     /* processes expanding each beam layer */
+#define MAX_JOBS 16
+#define PLAY_SPEED 500000  /* microseconds between replayed clicks */
+#define ANIM_SPEED 40000   /* microseconds between animation frames */
+#define ANIM_FRAMES 5      /* frames per gravity or column slide */
 
 #define COLOR_BACKGROUND 0
 #define COLOR_RED 1
@@ -37,6 +49,47 @@ static int game_over = 0;
 static int cms_size;
 static unsigned char red[NUM_COLORS], green[NUM_COLORS], blue[NUM_COLORS];
 
+/* Solver board: one byte per cell, 0 empty, otherwise color index + 1 */
+typedef struct {
+    unsigned char cell[CELLS];
+    int score;
+    int eval;
+    int parent;
+    int move;
+} Node;
+
+typedef struct {
+    int parent;
+    unsigned char move;
+} Step;
+
+/* Group labelling of the live board, rebuilt lazily after each change */
+static short group_label[CELLS];
+static int group_size[CELLS], group_first[CELLS];
+static int group_count = 0;
+static int groups_valid = 0;
+static int hover_group = -1;
+
+/* One bubble sliding from one cell to another, in pixels.  Gravity
+   slides come first, then column slides from slide_split onwards. */
+typedef struct {
+    short from_x, from_y;
+    short to_x, to_y;
+    short x, y;
+    short color;
+} Slide;
+
+static Slide slides[2 * CELLS];
+static int slide_count = 0;
+static int slide_split = 0;
+static int anim_frame = -1;
+static int last_x, last_y;
+static Pixrect *bubble_image[COLOR_COUNT];
+
+static int solution[MAX_MOVES];
+static int solution_length = 0;
+static int play_index = 0;
+
 static int colors[] = {
     COLOR_RED,
     COLOR_GREEN,
@@ -48,18 +101,76 @@ static int colors[] = {
 void init_board();
 void draw_board();
 void handle_click();
-int *find_cluster();
+void update_groups();
+void draw_bubble();
+void draw_status();
+void set_hover();
+void hover_at();
+int label_groups();
 void apply_gravity();
 void shift_columns();
 int is_game_over();
 void setup_colors();
+void init_images();
+void add_slide();
+void start_animation();
+void finish_animation();
 void handle_input();
+int add_candidate();
+int expand_range();
+int solve_board();
+Notify_value play_tick();
+Notify_value anim_tick();
 
 main(argc, argv)
 int argc;
 char **argv;
 {
-    srand((unsigned int)time(0));
+    unsigned int seed;
+    int i, solve, play, beam_width, jobs, par;
+    struct itimerval timer;
+
+    seed = (unsigned int)time(0);
+    solve = 0;
+    play = 0;
+    beam_width = DEFAULT_BEAM;
+    jobs = DEFAULT_JOBS;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) {
+            seed = (unsigned int)atol(argv[++i]);
+        } else if (strcmp(argv[i], "-beam") == 0 && i + 1 < argc) {
+            beam_width = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-jobs") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-solve") == 0) {
+            solve = 1;
+        } else if (strcmp(argv[i], "-play") == 0) {
+            play = 1;
+        } else {
+            fprintf(stderr, "usage: %s [-seed n] [-solve] [-play] [-beam width] [-jobs n]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (beam_width < 1) beam_width = 1;
+    if (jobs < 1) jobs = 1;
+    if (jobs > MAX_JOBS) jobs = MAX_JOBS;
+
+    srand(seed);
+    init_board();
+
+    if (solve || play) {
+        par = solve_board(beam_width, jobs);
+        if (par < 0) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        printf("seed %u par %d moves %d:", seed, par, solution_length);
+        for (i = 0; i < solution_length; i++) {
+            printf(" %d,%d", solution[i] % BOARD_SIZE, solution[i] / BOARD_SIZE);
+        }
+        printf("\n");
+        if (!play) exit(0);
+    }
 
     frame = window_create(NULL, FRAME,
         FRAME_LABEL,       "Bubble Breaker",
@@ -72,6 +183,7 @@ char **argv;
         WIN_HEIGHT,        WINDOW_HEIGHT,
         WIN_EVENT_PROC,    handle_input,
         WIN_CONSUME_KBD_EVENTS, WIN_UP_EVENTS | WIN_ASCII_EVENTS,
+        WIN_CONSUME_PICK_EVENTS, LOC_MOVE, LOC_WINEXIT, 0,
         0);
 
     pw = canvas_pixwin(canvas);
@@ -81,10 +193,18 @@ char **argv;
     }
 
     setup_colors();
-    init_board();
+    init_images();
     draw_board();
 
     window_fit(frame);
+
+    if (play) {
+        timer.it_value.tv_sec = 0;
+        timer.it_value.tv_usec = PLAY_SPEED;
+        timer.it_interval = timer.it_value;
+        notify_set_itimer_func(frame, play_tick, ITIMER_REAL, &timer, NULL);
+    }
+
     window_main_loop(frame);
     exit(0);
 }
@@ -116,6 +236,8 @@ void init_board()
     }
     score = 0;
     game_over = 0;
+    groups_valid = 0;
+    hover_group = -1;
 }
 
 void draw_circle(x0, y0, radius, color)
@@ -149,7 +271,8 @@ int x0, y0, radius, color;
     }
 }
 
-void fill_circle(x0, y0, radius, color)
+void fill_circle(pr, x0, y0, radius, color)
+Pixrect *pr;
 int x0, y0, radius, color;
 {
     int x = radius;
@@ -158,10 +281,10 @@ int x0, y0, radius, color;
 
     while (x >= y)
     {
-        pw_vector(pw, x0 - x, y0 + y, x0 + x, y0 + y, PIX_SRC | PIX_COLOR(color), 1);
-        pw_vector(pw, x0 - y, y0 + x, x0 + y, y0 + x, PIX_SRC | PIX_COLOR(color), 1);
-        pw_vector(pw, x0 - x, y0 - y, x0 + x, y0 - y, PIX_SRC | PIX_COLOR(color), 1);
-        pw_vector(pw, x0 - y, y0 - x, x0 + y, y0 - x, PIX_SRC | PIX_COLOR(color), 1);
+        pr_vector(pr, x0 - x, y0 + y, x0 + x, y0 + y, PIX_SRC | PIX_COLOR(color), 1);
+        pr_vector(pr, x0 - y, y0 + x, x0 + y, y0 + x, PIX_SRC | PIX_COLOR(color), 1);
+        pr_vector(pr, x0 - x, y0 - y, x0 + x, y0 - y, PIX_SRC | PIX_COLOR(color), 1);
+        pr_vector(pr, x0 - y, y0 - x, x0 + y, y0 - x, PIX_SRC | PIX_COLOR(color), 1);
 
         if (err <= 0)
         {
@@ -176,37 +299,139 @@ int x0, y0, radius, color;
     }
 }
 
+/* Render one bubble per color into memory so a bubble costs a
+   single pw_rop instead of a scanline per row */
+void init_images()
+{
+    int c, depth;
+
+    depth = pw->pw_pixrect->pr_depth;
+    for (c = 0; c < COLOR_COUNT; c++) {
+        bubble_image[c] = mem_create(CELL_SIZE, CELL_SIZE, depth);
+        if (bubble_image[c] == NULL) {
+            fprintf(stderr, "Failed to create bubble image\n");
+            exit(1);
+        }
+        pr_rop(bubble_image[c], 0, 0, CELL_SIZE, CELL_SIZE,
+               PIX_SRC | PIX_COLOR(COLOR_BACKGROUND), NULL, 0, 0);
+        fill_circle(bubble_image[c], CELL_SIZE/2, CELL_SIZE/2, CELL_SIZE/2 - 1, colors[c]);
+    }
+}
+
+void draw_bubble(i, j)
+int i, j;
+{
+    if (board[i][j] == -1) {
+        pw_writebackground(pw, j*CELL_SIZE, i*CELL_SIZE, CELL_SIZE, CELL_SIZE,
+                           PIX_SRC | PIX_COLOR(COLOR_BACKGROUND));
+        return;
+    }
+
+    pw_rop(pw, j*CELL_SIZE, i*CELL_SIZE, CELL_SIZE, CELL_SIZE,
+           PIX_SRC, bubble_image[board[i][j]], 0, 0);
+    if (hover_group >= 0 && group_label[i*BOARD_SIZE + j] == hover_group) {
+        draw_circle(j*CELL_SIZE + CELL_SIZE/2,
+                    i*CELL_SIZE + CELL_SIZE/2,
+                    CELL_SIZE/2 - 1,
+                    COLOR_WHITE);
+    }
+}
+
+void draw_status()
+{
+    char score_str[50];
+    int n;
+
+    pw_writebackground(pw, 0, BOARD_SIZE*CELL_SIZE, WINDOW_WIDTH, WINDOW_HEIGHT - BOARD_SIZE*CELL_SIZE,
+                       PIX_SRC | PIX_COLOR(COLOR_BACKGROUND));
+    if (hover_group >= 0) {
+        n = group_size[hover_group];
+        sprintf(score_str, "Score: %d  Group: %d (+%d)", score, n, n * n);
+    } else {
+        sprintf(score_str, "Score: %d", score);
+    }
+    pw_text(pw, 10, WINDOW_HEIGHT - 6, PIX_SRC | PIX_COLOR(COLOR_WHITE), 0, score_str);
+}
+
 void draw_board()
 {
     int i, j;
-    char score_str[50];
 
     pw_writebackground(pw, 0, 0, WINDOW_WIDTH, WINDOW_HEIGHT, PIX_SRC | PIX_COLOR(COLOR_BACKGROUND));
 
     for (i = 0; i < BOARD_SIZE; i++) {
         for (j = 0; j < BOARD_SIZE; j++) {
-            if (board[i][j] != -1) {
-                fill_circle(j*CELL_SIZE + CELL_SIZE/2, 
-                            i*CELL_SIZE + CELL_SIZE/2, 
-                            CELL_SIZE/2 - 1, 
-                            colors[board[i][j]]);
-            }
+            if (board[i][j] != -1) draw_bubble(i, j);
         }
     }
 
-    sprintf(score_str, "Score: %d", score);
-    pw_text(pw, 10, WINDOW_HEIGHT - 10, PIX_SRC | PIX_COLOR(COLOR_WHITE), 0, score_str);
+    draw_status();
     
     if (game_over) {
         pw_text(pw, WINDOW_WIDTH/2 - 80, WINDOW_HEIGHT/2, PIX_SRC | PIX_COLOR(COLOR_WHITE), 0, "Game Over! Click to restart");
     }
 }
 
+/* Relabel the board's groups if it changed since the last call */
+void update_groups()
+{
+    unsigned char cell[CELLS];
+    int i, j;
+
+    if (groups_valid) return;
+
+    for (i = 0; i < BOARD_SIZE; i++)
+        for (j = 0; j < BOARD_SIZE; j++)
+            cell[i*BOARD_SIZE + j] = board[i][j] + 1;
+    group_count = label_groups(cell, group_label, group_size, group_first);
+    groups_valid = 1;
+}
+
+/* Move the highlight to group g (-1 for none), repainting only the
+   bubbles that gain or lose the outline */
+void set_hover(g)
+int g;
+{
+    int old, i;
+
+    if (g == hover_group) return;
+
+    old = hover_group;
+    hover_group = g;
+    for (i = 0; i < CELLS; i++) {
+        if (group_label[i] != -1 && (group_label[i] == old || group_label[i] == g)) {
+            draw_bubble(i / BOARD_SIZE, i % BOARD_SIZE);
+        }
+    }
+    draw_status();
+}
+
+void hover_at(x, y)
+int x, y;
+{
+    int g;
+
+    if (anim_frame >= 0) return;
+    if (game_over || x < 0 || x >= BOARD_SIZE || y < 0 || y >= BOARD_SIZE) {
+        set_hover(-1);
+        return;
+    }
+
+    update_groups();
+    g = group_label[y*BOARD_SIZE + x];
+    if (g == -1 || group_size[g] < 2) {
+        set_hover(-1);
+    } else {
+        set_hover(g);
+    }
+}
+
 void handle_click(x, y)
 int x, y;
 {
-    int color, cluster_size, i;
-    int *cluster;
+    int g, i;
+
+    if (anim_frame >= 0) return;
 
     if (game_over) {
         init_board();
@@ -214,78 +439,118 @@ int x, y;
         return;
     }
 
-    color = board[y][x];
-    if (color == -1) return;
+    if (board[y][x] == -1) return;
 
-    cluster = find_cluster(x, y, color, &cluster_size);
-    if (cluster_size < 2) {
-        free(cluster);
-        return;
-    }
+    update_groups();
+    g = group_label[y*BOARD_SIZE + x];
+    if (group_size[g] < 2) return;
 
-    score += cluster_size * cluster_size;
+    score += group_size[g] * group_size[g];
 
-    for (i = 0; i < cluster_size; i++) {
-        board[cluster[i] / BOARD_SIZE][cluster[i] % BOARD_SIZE] = -1;
+    hover_group = -1;
+    for (i = 0; i < CELLS; i++) {
+        if (group_label[i] == g) {
+            board[i / BOARD_SIZE][i % BOARD_SIZE] = -1;
+            draw_bubble(i / BOARD_SIZE, i % BOARD_SIZE);
+        }
     }
-    free((char *)cluster);
 
+    slide_count = 0;
     apply_gravity();
+    slide_split = slide_count;
     shift_columns();
+    groups_valid = 0;
 
     if (is_game_over()) {
         game_over = 1;
     }
 
-    draw_board();
+    draw_status();
+    last_x = x;
+    last_y = y;
+    start_animation();
 }
 
-int *find_cluster(x, y, color, size)
-int x, y, color, *size;
+void start_animation()
 {
-    int *cluster, *stack;
-    int stack_size, cluster_size, dx, dy;
-    int visited[BOARD_SIZE][BOARD_SIZE];
-    int i, j, new_x, new_y;
-
-    for (i = 0; i < BOARD_SIZE; i++)
-        for (j = 0; j < BOARD_SIZE; j++)
-            visited[i][j] = 0;
+    struct itimerval timer;
 
-    cluster = (int *)malloc(BOARD_SIZE * BOARD_SIZE * sizeof(int));
-    stack = (int *)malloc(BOARD_SIZE * BOARD_SIZE * sizeof(int));
-    stack_size = 0;
-    cluster_size = 0;
+    if (slide_count == 0) {
+        finish_animation();
+        return;
+    }
 
-    stack[stack_size++] = y * BOARD_SIZE + x;
+    anim_frame = slide_split > 0 ? 0 : ANIM_FRAMES;
+    timer.it_value.tv_sec = 0;
+    timer.it_value.tv_usec = ANIM_SPEED;
+    timer.it_interval = timer.it_value;
+    notify_set_itimer_func(canvas, anim_tick, ITIMER_REAL, &timer, NULL);
+}
 
-    while (stack_size > 0) {
-        stack_size--;
-        i = stack[stack_size] / BOARD_SIZE;
-        j = stack[stack_size] % BOARD_SIZE;
+void finish_animation()
+{
+    anim_frame = -1;
+    if (game_over) {
+        pw_text(pw, WINDOW_WIDTH/2 - 80, WINDOW_HEIGHT/2, PIX_SRC | PIX_COLOR(COLOR_WHITE), 0, "Game Over! Click to restart");
+    }
+    hover_at(last_x, last_y);
+}
 
-        if (i < 0 || i >= BOARD_SIZE || j < 0 || j >= BOARD_SIZE || 
-            board[i][j] != color || visited[i][j]) {
-            continue;
-        }
+/* Step the sliding bubbles one frame: erase every moving bubble at its
+   previous spot, then draw them all at the new one.  Bubbles that stay
+   put are never touched. */
+Notify_value anim_tick(client, which)
+Notify_client client;
+int which;
+{
+    int first, last, step, i;
+    Slide *s;
+
+    if (anim_frame < ANIM_FRAMES) {
+        first = 0;
+        last = slide_split;
+        step = anim_frame + 1;
+    } else {
+        first = slide_split;
+        last = slide_count;
+        step = anim_frame - ANIM_FRAMES + 1;
+    }
 
-        visited[i][j] = 1;
-        cluster[cluster_size++] = i * BOARD_SIZE + j;
+    for (i = first; i < last; i++) {
+        s = &slides[i];
+        pw_writebackground(pw, s->x, s->y, CELL_SIZE, CELL_SIZE,
+                           PIX_SRC | PIX_COLOR(COLOR_BACKGROUND));
+    }
+    for (i = first; i < last; i++) {
+        s = &slides[i];
+        s->x = s->from_x + (s->to_x - s->from_x) * step / ANIM_FRAMES;
+        s->y = s->from_y + (s->to_y - s->from_y) * step / ANIM_FRAMES;
+        pw_rop(pw, s->x, s->y, CELL_SIZE, CELL_SIZE,
+               PIX_SRC, bubble_image[s->color], 0, 0);
+    }
 
-        for (dx = -1; dx <= 1; dx++) {
-            for (dy = -1; dy <= 1; dy++) {
-                if (dx == 0 || dy == 0) {
-                    new_x = j + dx;
-                    new_y = i + dy;
-                    stack[stack_size++] = new_y * BOARD_SIZE + new_x;
-                }
-            }
-        }
+    anim_frame++;
+    if (anim_frame == ANIM_FRAMES && slide_split == slide_count)
+        anim_frame = 2 * ANIM_FRAMES;
+    if (anim_frame >= 2 * ANIM_FRAMES) {
+        notify_set_itimer_func(canvas, NOTIFY_FUNC_NULL, ITIMER_REAL, NULL, NULL);
+        finish_animation();
     }
+    return NOTIFY_DONE;
+}
 
-    free((char *)stack);
-    *size = cluster_size;
-    return cluster;
+/* Record a bubble of the given color moving between two cells */
+void add_slide(from_row, from_col, to_row, to_col, color)
+int from_row, from_col, to_row, to_col, color;
+{
+    Slide *s;
+
+    s = &slides[slide_count++];
+    s->from_x = s->x = from_col * CELL_SIZE;
+    s->from_y = s->y = from_row * CELL_SIZE;
+    s->to_x = to_col * CELL_SIZE;
+    s->to_y = to_row * CELL_SIZE;
+    s->color = color;
 }
 
 void apply_gravity()
@@ -296,6 +561,7 @@ void apply_gravity()
         k = BOARD_SIZE - 1;
         for (i = BOARD_SIZE - 1; i >= 0; i--) {
             if (board[i][j] != -1) {
+                if (k != i) add_slide(i, j, k, j, board[i][j]);
                 board[k][j] = board[i][j];
                 k--;
             }
@@ -306,45 +572,395 @@ void apply_gravity()
     }
 }
 
+/* Close up empty columns in one left-to-right pass */
 void shift_columns()
 {
-    int i, j, k, empty;
-
-    for (j = 0; j < BOARD_SIZE - 1; j++) {
-        if (board[BOARD_SIZE-1][j] == -1) {
-            empty = 1;
-            for (k = j + 1; k < BOARD_SIZE; k++) {
-                if (board[BOARD_SIZE-1][k] != -1) {
-                    empty = 0;
-                    for (i = 0; i < BOARD_SIZE; i++) {
-                        board[i][j] = board[i][k];
-                        board[i][k] = -1;
-                    }
-                    break;
-                }
+    int i, j, dst;
+
+    dst = 0;
+    for (j = 0; j < BOARD_SIZE; j++) {
+        if (board[BOARD_SIZE-1][j] == -1) continue;
+        if (dst != j) {
+            for (i = 0; i < BOARD_SIZE; i++) {
+                if (board[i][j] != -1) add_slide(i, j, i, dst, board[i][j]);
+                board[i][dst] = board[i][j];
+                board[i][j] = -1;
             }
-            if (empty) break;
         }
+        dst++;
     }
 }
 
 int is_game_over()
 {
-    int i, j, cluster_size;
-    int *cluster;
+    int g;
 
-    for (i = 0; i < BOARD_SIZE; i++) {
-        for (j = 0; j < BOARD_SIZE; j++) {
-            if (board[i][j] != -1) {
-                cluster = find_cluster(j, i, board[i][j], &cluster_size);
-                free((char *)cluster);
-                if (cluster_size >= 2) {
-                    return 0;
+    update_groups();
+    for (g = 0; g < group_count; g++) {
+        if (group_size[g] >= 2) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Find the connected same-colored groups of a solver board.  Each
+   occupied cell gets its group number in label[]; size[] and first[]
+   receive the size and one member cell of every group. */
+int label_groups(cell, label, size, first)
+unsigned char *cell;
+short *label;
+int *size, *first;
+{
+    int stack[CELLS];
+    int i, n, top, c, k, color;
+
+    for (i = 0; i < CELLS; i++)
+        label[i] = -1;
+
+    n = 0;
+    for (i = 0; i < CELLS; i++) {
+        if (cell[i] == 0 || label[i] != -1) continue;
+        color = cell[i];
+        size[n] = 0;
+        first[n] = i;
+        top = 0;
+        stack[top++] = i;
+        label[i] = n;
+        while (top > 0) {
+            c = stack[--top];
+            size[n]++;
+            k = c - BOARD_SIZE;
+            if (k >= 0 && cell[k] == color && label[k] == -1) {
+                label[k] = n;
+                stack[top++] = k;
+            }
+            k = c + BOARD_SIZE;
+            if (k < CELLS && cell[k] == color && label[k] == -1) {
+                label[k] = n;
+                stack[top++] = k;
+            }
+            k = c - 1;
+            if (c % BOARD_SIZE > 0 && cell[k] == color && label[k] == -1) {
+                label[k] = n;
+                stack[top++] = k;
+            }
+            k = c + 1;
+            if (c % BOARD_SIZE < BOARD_SIZE - 1 && cell[k] == color && label[k] == -1) {
+                label[k] = n;
+                stack[top++] = k;
+            }
+        }
+        n++;
+    }
+    return n;
+}
+
+/* Remove group g, then drop bubbles and close empty columns in place */
+void remove_group(cell, label, g)
+unsigned char *cell;
+short *label;
+int g;
+{
+    int i, j, k, dst;
+
+    for (i = 0; i < CELLS; i++)
+        if (label[i] == g) cell[i] = 0;
+
+    dst = 0;
+    for (j = 0; j < BOARD_SIZE; j++) {
+        k = BOARD_SIZE - 1;
+        for (i = BOARD_SIZE - 1; i >= 0; i--) {
+            if (cell[i*BOARD_SIZE + j]) {
+                cell[k*BOARD_SIZE + dst] = cell[i*BOARD_SIZE + j];
+                k--;
+            }
+        }
+        if (k == BOARD_SIZE - 1) continue;
+        for (; k >= 0; k--)
+            cell[k*BOARD_SIZE + dst] = 0;
+        if (dst != j)
+            for (i = 0; i < BOARD_SIZE; i++)
+                cell[i*BOARD_SIZE + j] = 0;
+        dst++;
+    }
+}
+
+/* Score plus an optimistic estimate of what the remaining colors can
+   still earn if each were cleared as one group */
+int evaluate(node)
+Node *node;
+{
+    int count[COLOR_COUNT + 1];
+    int i, eval;
+
+    for (i = 0; i <= COLOR_COUNT; i++) count[i] = 0;
+    for (i = 0; i < CELLS; i++) count[node->cell[i]]++;
+
+    eval = node->score;
+    for (i = 1; i <= COLOR_COUNT; i++)
+        if (count[i] > 2) eval += (count[i] - 2) * (count[i] - 2);
+    return eval;
+}
+
+unsigned long hash_node(node)
+Node *node;
+{
+    unsigned long h = 2166136261UL;
+    int i;
+
+    for (i = 0; i < CELLS; i++) {
+        h ^= node->cell[i];
+        h *= 16777619UL;
+    }
+    return h;
+}
+
+int compare_nodes(a, b)
+Node *a, *b;
+{
+    return b->eval - a->eval;
+}
+
+/* Add cand[ncand] to the candidates unless a candidate already has its
+   board, in which case keep the better score of the two.  Returns the
+   new number of candidates. */
+int add_candidate(cand, ncand, table, table_size)
+Node *cand;
+int ncand;
+int *table;
+int table_size;
+{
+    Node *child = &cand[ncand];
+    int slot;
+
+    slot = hash_node(child) & (table_size - 1);
+    while (table[slot] != -1 &&
+           memcmp(cand[table[slot]].cell, child->cell, CELLS) != 0)
+        slot = (slot + 1) & (table_size - 1);
+    if (table[slot] != -1) {
+        if (cand[table[slot]].score < child->score)
+            cand[table[slot]] = *child;
+        return ncand;
+    }
+    table[slot] = ncand;
+    return ncand + 1;
+}
+
+/* Expand beam entries from..to-1 into cand[] after the ncand already
+   there.  best[] holds the score and beam index of the best entry
+   with no moves left.  Returns the new number of candidates. */
+int expand_range(beam, from, to, cand, ncand, table, table_size, best)
+Node *beam;
+int from, to;
+Node *cand;
+int ncand;
+int *table;
+int table_size;
+int *best;
+{
+    short label[CELLS];
+    int size[CELLS], first[CELLS];
+    int i, g, n, terminal;
+    Node *child;
+
+    for (i = from; i < to; i++) {
+        n = label_groups(beam[i].cell, label, size, first);
+        terminal = 1;
+        for (g = 0; g < n; g++) {
+            if (size[g] < 2) continue;
+            terminal = 0;
+            child = &cand[ncand];
+            memcpy(child->cell, beam[i].cell, CELLS);
+            remove_group(child->cell, label, g);
+            child->score = beam[i].score + size[g] * size[g];
+            child->eval = evaluate(child);
+            child->parent = i;
+            child->move = first[g];
+            ncand = add_candidate(cand, ncand, table, table_size);
+        }
+        if (terminal && beam[i].score > best[0]) {
+            best[0] = beam[i].score;
+            best[1] = i;
+        }
+    }
+    return ncand;
+}
+
+/* Read exactly len bytes from a worker's pipe */
+int read_all(fd, buf, len)
+int fd;
+char *buf;
+int len;
+{
+    int n;
+
+    while (len > 0) {
+        n = read(fd, buf, len);
+        if (n <= 0) return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int write_all(fd, buf, len)
+int fd;
+char *buf;
+int len;
+{
+    int n;
+
+    while (len > 0) {
+        n = write(fd, buf, len);
+        if (n <= 0) return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Beam search over click sequences from the current board.  Children
+   that reach an identical board are merged keeping the better score.
+   With jobs > 1 each layer of the beam is split between that many
+   forked workers, which send their merged children back through
+   pipes to be merged again here.  Leaves the best sequence in
+   solution[] and returns its final score, or -1 if memory runs out. */
+int solve_board(width, jobs)
+int width, jobs;
+{
+    Node *beam, *cand;
+    Step *trail;
+    int *table;
+    int fd[MAX_JOBS], pid[MAX_JOBS], from[MAX_JOBS + 1];
+    int pipe_fd[2];
+    int i, j, k, n, nbeam, ncand, max_cand, table_size, depth, status;
+    int best[2], best_depth, worker_best[2];
+
+    max_cand = width * (CELLS / 2);
+    for (table_size = 1; table_size < 2 * max_cand; table_size <<= 1)
+        ;
+    beam = (Node *)malloc(width * sizeof(Node));
+    cand = (Node *)malloc(max_cand * sizeof(Node));
+    trail = (Step *)malloc((MAX_MOVES + 1) * width * sizeof(Step));
+    table = (int *)malloc(table_size * sizeof(int));
+    if (beam == NULL || cand == NULL || trail == NULL || table == NULL)
+        return -1;
+
+    for (i = 0; i < BOARD_SIZE; i++)
+        for (j = 0; j < BOARD_SIZE; j++)
+            beam[0].cell[i*BOARD_SIZE + j] = board[i][j] + 1;
+    beam[0].score = 0;
+    nbeam = 1;
+    best[0] = -1;
+    best[1] = 0;
+    best_depth = 0;
+
+    for (depth = 0; nbeam > 0; depth++) {
+        for (i = 0; i < table_size; i++) table[i] = -1;
+        ncand = 0;
+        worker_best[0] = best[0];
+
+        /* Start the workers on even shares of the beam, each with the
+           empty table it inherits; a share that cannot be forked is
+           expanded here afterwards */
+        n = nbeam < jobs ? 1 : jobs;
+        for (k = 0; k <= n; k++)
+            from[k] = nbeam * k / n;
+        for (k = 0; k < n && n > 1; k++) {
+            pid[k] = -1;
+            fd[k] = -1;
+            if (pipe(pipe_fd) < 0) continue;
+            pid[k] = fork();
+            if (pid[k] == 0) {
+                close(pipe_fd[0]);
+                worker_best[0] = -1;
+                ncand = expand_range(beam, from[k], from[k + 1], cand, 0,
+                                     table, table_size, worker_best);
+                if (write_all(pipe_fd[1], (char *)&ncand, sizeof(int)) < 0 ||
+                    write_all(pipe_fd[1], (char *)cand, ncand * sizeof(Node)) < 0 ||
+                    write_all(pipe_fd[1], (char *)worker_best, 2 * sizeof(int)) < 0)
+                    _exit(1);
+                _exit(0);
+            }
+            close(pipe_fd[1]);
+            if (pid[k] < 0) {
+                close(pipe_fd[0]);
+                continue;
+            }
+            fd[k] = pipe_fd[0];
+        }
+
+        /* Merge what the workers found, in beam order */
+        for (k = 0; k < n; k++) {
+            if (n > 1 && fd[k] >= 0) {
+                if (read_all(fd[k], (char *)&j, sizeof(int)) == 0) {
+                    for (i = 0; i < j; i++) {
+                        if (read_all(fd[k], (char *)&cand[ncand], sizeof(Node)) < 0)
+                            break;
+                        ncand = add_candidate(cand, ncand, table, table_size);
+                    }
+                    if (i == j &&
+                        read_all(fd[k], (char *)worker_best, 2 * sizeof(int)) == 0) {
+                        if (worker_best[0] > best[0]) {
+                            best[0] = worker_best[0];
+                            best[1] = worker_best[1];
+                            best_depth = depth;
+                        }
+                        close(fd[k]);
+                        waitpid(pid[k], &status, 0);
+                        continue;
+                    }
                 }
+                /* The worker failed: its share is done again below */
+                close(fd[k]);
+                waitpid(pid[k], &status, 0);
+                pid[k] = -1;
+            }
+            worker_best[0] = best[0];
+            ncand = expand_range(beam, from[k], from[k + 1], cand, ncand,
+                                 table, table_size, worker_best);
+            if (worker_best[0] > best[0]) {
+                best[0] = worker_best[0];
+                best[1] = worker_best[1];
+                best_depth = depth;
             }
         }
+
+        qsort((char *)cand, ncand, sizeof(Node), compare_nodes);
+        nbeam = ncand < width ? ncand : width;
+        for (i = 0; i < nbeam; i++) {
+            beam[i] = cand[i];
+            trail[(depth + 1) * width + i].parent = cand[i].parent;
+            trail[(depth + 1) * width + i].move = cand[i].move;
+        }
     }
-    return 1;
+
+    solution_length = best_depth;
+    for (i = best_depth; i > 0; i--) {
+        solution[i - 1] = trail[i * width + best[1]].move;
+        best[1] = trail[i * width + best[1]].parent;
+    }
+
+    free((char *)beam);
+    free((char *)cand);
+    free((char *)trail);
+    free((char *)table);
+    return best[0];
+}
+
+Notify_value play_tick(client, which)
+Notify_client client;
+int which;
+{
+    if (anim_frame >= 0) return NOTIFY_DONE;
+    if (play_index >= solution_length || game_over) {
+        notify_set_itimer_func(frame, NOTIFY_FUNC_NULL, ITIMER_REAL, NULL, NULL);
+        return NOTIFY_DONE;
+    }
+    handle_click(solution[play_index] % BOARD_SIZE, solution[play_index] / BOARD_SIZE);
+    play_index++;
+    return NOTIFY_DONE;
 }
 
 void handle_input(window, event, arg)
@@ -360,6 +976,14 @@ caddr_t arg;
         if (x >= 0 && x < BOARD_SIZE && y >= 0 && y < BOARD_SIZE) {
             handle_click(x, y);
         }
+    } else if (event_action(event) == LOC_MOVE) {
+        if (event_x(event) < 0 || event_y(event) < 0) {
+            set_hover(-1);
+        } else {
+            hover_at(event_x(event) / CELL_SIZE, event_y(event) / CELL_SIZE);
+        }
+    } else if (event_action(event) == LOC_WINEXIT) {
+        set_hover(-1);
     } else if (event_is_ascii(event) && event_id(event) == 'q') {
         exit(0);
     }
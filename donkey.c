@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
+#include <sys/time.h>
 
 #define WINDOW_WIDTH 400
 #define WINDOW_HEIGHT 600
@@ -18,8 +19,32 @@
 #define CAR_HEIGHT 60
 #define DONKEY_WIDTH 60
 #define DONKEY_HEIGHT 40
-#define ROAD_WIDTH 200
 #define LANE_WIDTH 100
+#define SIM_STEP 50000      /* usec of game time per update_game() */
+#define DONKEY_SPEED 5      /* pixels the donkey moves per step */
+#define MAX_STEPS 10        /* fewest steps caught up per frame before time is dropped */
+#define RENDER_FPS 60       /* default frames drawn per second */
+#define MAX_FPS 200
+#define MAX_INPUTS 16       /* lane changes queued within one step */
+#define MAX_DIRTY 8         /* rectangles blitted per frame before merging */
+#define DEBRIS_WIDTH 16
+#define DEBRIS_HEIGHT 12
+#define MAX_OBJECT_HEIGHT CAR_HEIGHT
+#define MAX_LANES 4
+#define LANE_SLOTS 64       /* obstacles a lane can hold */
+#define MAX_OBJECTS (MAX_LANES * LANE_SLOTS)
+#define TRAFFIC_LANES 3     /* default lanes in traffic mode */
+#define DIFFICULTY 5        /* default traffic difficulty */
+#define MAX_DIFFICULTY 10
+#define MIN_GAP 4           /* least road between obstacles in a lane */
+#define GAP_SPREAD 20       /* random extra gap per level below MAX_DIFFICULTY */
+#define OPEN_STEPS 60       /* least steps before the open lane moves on */
+#define CAR_Y (WINDOW_HEIGHT - CAR_HEIGHT - 10)
+#define SCORE_X 10
+#define SCORE_Y 20
+#define HELP_Y (WINDOW_HEIGHT - 20)
+#define BOOM_X (WINDOW_WIDTH/2 - 30)
+#define BOOM_Y (WINDOW_HEIGHT/2)
 
 #define COLOR_BACKGROUND 0
 #define COLOR_CAR 1
@@ -28,20 +53,92 @@
 #define COLOR_ROAD 4
 #define COLOR_GRASS 5
 #define COLOR_TERM 6
+#define COLOR_TRAFFIC 7
+#define COLOR_DEBRIS 8
+
+#define OBJ_DONKEY 0
+#define OBJ_CAR 1
+#define OBJ_DEBRIS 2
+#define NUM_KINDS 3
+
+/* Slot of the k'th lowest obstacle in a lane */
+#define LANE_SLOT(lane, k) ((lane) * LANE_SLOTS + (lane_first[lane] + (k)) % LANE_SLOTS)
 
 Frame frame;
 Canvas canvas;
 Pixwin *pw;
 
-int car_lane;
-int donkey_y;
-int donkey_lane;
+int car_lane;           /* lane the car is drawn in, as last steered */
 int player_score;
 int donkey_score;
 int game_over;
 int cms_size;
 unsigned char red[NUM_COLORS], green[NUM_COLORS], blue[NUM_COLORS];
 
+/* The game steps at a fixed SIM_STEP whatever the frame rate: each
+   frame adds the real time since the last one to sim_time and runs
+   as many steps as fit, and the rest positions the donkey between
+   its last two steps */
+int render_fps = RENDER_FPS;
+int max_steps;          /* MAX_STEPS, or two frames' worth at low rates */
+long sim_time;          /* usec of real time not yet simulated */
+struct timeval last_frame;
+
+/* Lane changes show at once but reach the game at the time of the key
+   press: input_at is usec after the last step, and update_game() moves
+   sim_lane through them as it steps past */
+int sim_lane;           /* lane the game has the car in */
+int input_lane[MAX_INPUTS];
+long input_at[MAX_INPUTS];
+int input_count;
+
+/* Classic mode sends one donkey at a time down two lanes; traffic mode
+   keeps every lane full of donkeys, cars and debris */
+int traffic;
+int num_lanes;
+int road_left;
+int difficulty = DIFFICULTY;
+char *help_text;
+
+/* Obstacles live in a fixed pool, a structure of arrays split into
+   LANE_SLOTS slots per lane.  Everything in a lane moves at the lane's
+   speed and enters at the top, so each lane is a ring ordered from the
+   lowest obstacle up, and the collision check only looks at the bottom
+   of the car's lane however many obstacles there are. */
+int obj_kind[MAX_OBJECTS];
+int obj_y[MAX_OBJECTS];
+int obj_prev_y[MAX_OBJECTS];    /* obj_y before the last step */
+int obj_drawn_x[MAX_OBJECTS], obj_drawn_y[MAX_OBJECTS];    /* where drawn last frame */
+int obj_drawn_w[MAX_OBJECTS], obj_drawn_h[MAX_OBJECTS];
+int lane_first[MAX_LANES];      /* slot offset of the lowest obstacle */
+int lane_count[MAX_LANES];
+int lane_speed[MAX_LANES];      /* pixels per step */
+int lane_wait[MAX_LANES];       /* pixels to move before the next one enters */
+
+/* However dense the traffic, nothing enters open_lane, so there is
+   always a way through.  Every so often a lane next to it stops taking
+   obstacles too, and once that lane is clear past the car it becomes
+   the open lane and the old one fills again; new obstacles take a few
+   seconds to come down, which is the player's time to move over. */
+int open_lane;
+int next_open;                  /* lane being cleared, or -1 */
+int open_wait;                  /* steps before picking next_open */
+int kind_width[NUM_KINDS] = { DONKEY_WIDTH, CAR_WIDTH, DEBRIS_WIDTH };
+int kind_height[NUM_KINDS] = { DONKEY_HEIGHT, CAR_HEIGHT, DEBRIS_HEIGHT };
+
+/* Frames are composed offscreen.  road_image holds the scenery, drawn
+   once; each frame puts the road back under last frame's sprites and
+   text in frame_image, draws them again and blits only the rectangles
+   that changed. */
+Pixrect *road_image;
+Pixrect *frame_image;
+struct pixfont *font;
+int car_x, car_y, car_w, car_h;             /* where the car was last drawn */
+char shown_score[40];   /* score text on screen */
+int shown_boom;
+int dirty_x[MAX_DIRTY], dirty_y[MAX_DIRTY], dirty_w[MAX_DIRTY], dirty_h[MAX_DIRTY];
+int dirty_count;
+
 /* Function prototypes */
 main();
 setup_colors();
@@ -49,15 +146,62 @@ init_game();
 draw_game();
 update_game();
 handle_input();
+steer();
+drop_input();
+apply_input();
+hit_car();
+redraw_car();
+blit_dirty();
 Notify_value game_timer();
 draw_car();
 draw_donkey();
+draw_debris();
+draw_object();
+add_object();
+erase_object();
+clear_objects();
+spawn_objects();
+make_scenery();
+restore_rect();
+add_dirty();
+draw_text();
+repaint_canvas();
 
 main(argc, argv)
 int argc;
 char **argv;
 {
     struct itimerval timer_value;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-fps") == 0 && i + 1 < argc) {
+            render_fps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-traffic") == 0) {
+            traffic = 1;
+        } else if (strcmp(argv[i], "-lanes") == 0 && i + 1 < argc) {
+            num_lanes = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-difficulty") == 0 && i + 1 < argc) {
+            difficulty = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [-fps n] [-traffic] [-lanes n] [-difficulty n]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (render_fps < 1) render_fps = 1;
+    if (render_fps > MAX_FPS) render_fps = MAX_FPS;
+    max_steps = 2 * (1000000 / render_fps) / SIM_STEP;
+    if (max_steps < MAX_STEPS) max_steps = MAX_STEPS;
+    if (num_lanes == 0) num_lanes = traffic ? TRAFFIC_LANES : 2;
+    if (num_lanes < 2) num_lanes = 2;
+    if (num_lanes > MAX_LANES) num_lanes = MAX_LANES;
+    if (difficulty < 1) difficulty = 1;
+    if (difficulty > MAX_DIFFICULTY) difficulty = MAX_DIFFICULTY;
+    if (num_lanes == 2) {
+        help_text = "Space: Change Lane  Q: Quit";
+    } else {
+        help_text = "A/D, Space: Change Lane  Q: Quit";
+    }
 
     srand(time(0));
     
@@ -76,6 +220,7 @@ char **argv;
                            WIN_HEIGHT, WINDOW_HEIGHT,
                            WIN_EVENT_PROC, handle_input,
                            WIN_CONSUME_KBD_EVENTS, WIN_UP_EVENTS | WIN_ASCII_EVENTS,
+                           CANVAS_REPAINT_PROC, repaint_canvas,
                            0);
     if (canvas == NULL) {
         fprintf(stderr, "Failed to create canvas\n");
@@ -89,12 +234,15 @@ char **argv;
     }
 
     setup_colors();
+    make_scenery();
     init_game();
     window_fit(frame);
 
-    /* Set up the timer */
-    timer_value.it_value.tv_sec = 0;
-    timer_value.it_value.tv_usec = 50000; /* 20 FPS */
+    /* Set up the frame timer; the game itself steps at SIM_STEP */
+    gettimeofday(&last_frame, NULL);
+    sim_time = 0;
+    timer_value.it_value.tv_sec = (1000000 / render_fps) / 1000000;
+    timer_value.it_value.tv_usec = (1000000 / render_fps) % 1000000;
     timer_value.it_interval = timer_value.it_value;
     notify_set_itimer_func(frame, game_timer, ITIMER_REAL, &timer_value, NULL);
 
@@ -112,6 +260,8 @@ setup_colors()
     red[COLOR_ROAD] = 50; green[COLOR_ROAD] = 50; blue[COLOR_ROAD] = 50;
     red[COLOR_GRASS] = 0; green[COLOR_GRASS] = 255; blue[COLOR_GRASS] = 0;
     red[COLOR_TERM] = 0; green[COLOR_TERM] = 0; blue[COLOR_TERM] = 0;
+    red[COLOR_TRAFFIC] = 0; green[COLOR_TRAFFIC] = 0; blue[COLOR_TRAFFIC] = 255;
+    red[COLOR_DEBRIS] = 150; green[COLOR_DEBRIS] = 100; blue[COLOR_DEBRIS] = 50;
     
     pw_setcmsname(pw, "donkey_cms");
     pw_putcolormap(pw, 0, NUM_COLORS, red, green, blue);
@@ -119,121 +269,506 @@ setup_colors()
 
 init_game()
 {
+    int lane;
+
     car_lane = 0;
-    donkey_y = -DONKEY_HEIGHT;
-    donkey_lane = rand() % 2;
+    sim_lane = 0;
+    input_count = 0;
+    clear_objects();
+    for (lane = 0; lane < num_lanes; lane++) {
+        /* Traffic lanes run at different speeds and start staggered */
+        if (traffic) {
+            lane_speed[lane] = DONKEY_SPEED + rand() % (1 + difficulty / 2);
+            lane_wait[lane] = rand() % (GAP_SPREAD * (MAX_DIFFICULTY + 1 - difficulty));
+        } else {
+            lane_speed[lane] = DONKEY_SPEED;
+            lane_wait[lane] = 0;
+        }
+    }
+    open_lane = car_lane;
+    next_open = -1;
+    open_wait = OPEN_STEPS + rand() % OPEN_STEPS;
     player_score = 0;
     donkey_score = 0;
     game_over = 0;
+    spawn_objects();
 }
 
-draw_car(x, y)
-int x, y;
+/* Put a new obstacle just above the top of a lane */
+add_object(lane, kind)
+int lane, kind;
+{
+    int i;
+
+    i = LANE_SLOT(lane, lane_count[lane]);
+    lane_count[lane]++;
+    obj_kind[i] = kind;
+    obj_y[i] = -kind_height[kind];
+    obj_prev_y[i] = obj_y[i];
+    obj_drawn_w[i] = 0;
+    obj_drawn_h[i] = 0;
+}
+
+/* Put the road back where an obstacle leaving the pool was drawn */
+erase_object(i)
+int i;
+{
+    restore_rect(obj_drawn_x[i], obj_drawn_y[i], obj_drawn_w[i], obj_drawn_h[i]);
+    add_dirty(obj_drawn_x[i], obj_drawn_y[i], obj_drawn_w[i], obj_drawn_h[i]);
+    obj_drawn_w[i] = 0;
+    obj_drawn_h[i] = 0;
+}
+
+clear_objects()
+{
+    int lane, k;
+
+    for (lane = 0; lane < MAX_LANES; lane++) {
+        for (k = 0; k < lane_count[lane]; k++) {
+            erase_object(LANE_SLOT(lane, k));
+        }
+        lane_first[lane] = 0;
+        lane_count[lane] = 0;
+    }
+}
+
+/* Start new obstacles: in classic mode a donkey once the last one is
+   gone, in traffic mode one in each lane that has moved far enough,
+   packed closer and with more debris the higher the difficulty, but
+   none in the open lane or the one being cleared to take over */
+spawn_objects()
+{
+    int lane, kind, r, k;
+
+    if (!traffic) {
+        for (lane = 0; lane < num_lanes; lane++) {
+            if (lane_count[lane] > 0) return;
+        }
+        add_object(rand() % num_lanes, OBJ_DONKEY);
+        return;
+    }
+
+    if (next_open < 0) {
+        if (--open_wait <= 0) {
+            if (open_lane == 0) {
+                next_open = 1;
+            } else if (open_lane == num_lanes - 1) {
+                next_open = open_lane - 1;
+            } else {
+                next_open = open_lane + (rand() % 2 ? 1 : -1);
+            }
+        }
+    } else {
+        /* Hand over once the last obstacle is below the car */
+        k = lane_count[next_open];
+        if (k == 0 || obj_y[LANE_SLOT(next_open, k - 1)] >= CAR_Y + CAR_HEIGHT) {
+            open_lane = next_open;
+            next_open = -1;
+            open_wait = OPEN_STEPS + rand() % OPEN_STEPS;
+        }
+    }
+
+    for (lane = 0; lane < num_lanes; lane++) {
+        if (lane == open_lane || lane == next_open) continue;
+        if (lane_wait[lane] > 0 || lane_count[lane] == LANE_SLOTS) continue;
+        r = rand() % (2 * MAX_DIFFICULTY);
+        if (r < difficulty) {
+            kind = OBJ_DEBRIS;
+        } else {
+            kind = r % 2 ? OBJ_CAR : OBJ_DONKEY;
+        }
+        add_object(lane, kind);
+        lane_wait[lane] = kind_height[kind] + MIN_GAP +
+                          rand() % (GAP_SPREAD * (MAX_DIFFICULTY + 1 - difficulty));
+    }
+}
+
+draw_car(pr, x, y, color)
+Pixrect *pr;
+int x, y, color;
 {
     /* Car body */
-    pw_rop(pw, x, y + 20, CAR_WIDTH, CAR_HEIGHT - 20, PIX_SRC | PIX_COLOR(COLOR_CAR), 0, 0, 0);
+    pr_rop(pr, x, y + 20, CAR_WIDTH, CAR_HEIGHT - 20, PIX_SRC | PIX_COLOR(color), 0, 0, 0);
     
     /* Car roof */
-    pw_rop(pw, x + 5, y, CAR_WIDTH - 10, 20, PIX_SRC | PIX_COLOR(COLOR_CAR), 0, 0, 0);
+    pr_rop(pr, x + 5, y, CAR_WIDTH - 10, 20, PIX_SRC | PIX_COLOR(color), 0, 0, 0);
     
     /* Windows */
-    pw_rop(pw, x + 7, y + 5, 10, 15, PIX_SRC | PIX_COLOR(COLOR_TEXT), 0, 0, 0);
-    pw_rop(pw, x + CAR_WIDTH - 17, y + 5, 10, 15, PIX_SRC | PIX_COLOR(COLOR_TEXT), 0, 0, 0);
+    pr_rop(pr, x + 7, y + 5, 10, 15, PIX_SRC | PIX_COLOR(COLOR_TEXT), 0, 0, 0);
+    pr_rop(pr, x + CAR_WIDTH - 17, y + 5, 10, 15, PIX_SRC | PIX_COLOR(COLOR_TEXT), 0, 0, 0);
     
     /* Wheels */
-    pw_rop(pw, x + 5, y + CAR_HEIGHT - 10, 10, 10, PIX_SRC | PIX_COLOR(COLOR_TEXT), 0, 0, 0);
-    pw_rop(pw, x + CAR_WIDTH - 15, y + CAR_HEIGHT - 10, 10, 10, PIX_SRC | PIX_COLOR(COLOR_TEXT), 0, 0, 0);
+    pr_rop(pr, x + 5, y + CAR_HEIGHT - 10, 10, 10, PIX_SRC | PIX_COLOR(COLOR_TEXT), 0, 0, 0);
+    pr_rop(pr, x + CAR_WIDTH - 15, y + CAR_HEIGHT - 10, 10, 10, PIX_SRC | PIX_COLOR(COLOR_TEXT), 0, 0, 0);
 }
 
-draw_donkey(x, y)
+draw_donkey(pr, x, y)
+Pixrect *pr;
 int x, y;
 {
     /* Donkey body */
-    pw_rop(pw, x + 10, y + 10, DONKEY_WIDTH - 20, DONKEY_HEIGHT - 10, PIX_SRC | PIX_COLOR(COLOR_DONKEY), 0, 0, 0);
+    pr_rop(pr, x + 10, y + 10, DONKEY_WIDTH - 20, DONKEY_HEIGHT - 10, PIX_SRC | PIX_COLOR(COLOR_DONKEY), 0, 0, 0);
     
     /* Head */
-    pw_rop(pw, x, y, 20, 20, PIX_SRC | PIX_COLOR(COLOR_DONKEY), 0, 0, 0);
+    pr_rop(pr, x, y, 20, 20, PIX_SRC | PIX_COLOR(COLOR_DONKEY), 0, 0, 0);
     
     /* Ears */
-    pw_vector(pw, x + 5, y, x, y - 10, PIX_SRC | PIX_COLOR(COLOR_DONKEY), 2);
-    pw_vector(pw, x + 15, y, x + 20, y - 10, PIX_SRC | PIX_COLOR(COLOR_DONKEY), 2);
+    pr_vector(pr, x + 5, y, x, y - 10, PIX_SRC | PIX_COLOR(COLOR_DONKEY), 2);
+    pr_vector(pr, x + 15, y, x + 20, y - 10, PIX_SRC | PIX_COLOR(COLOR_DONKEY), 2);
     
     /* Legs */
-    pw_vector(pw, x + 15, y + DONKEY_HEIGHT - 10, x + 15, y + DONKEY_HEIGHT, PIX_SRC | PIX_COLOR(COLOR_DONKEY), 2);
-    pw_vector(pw, x + 35, y + DONKEY_HEIGHT - 10, x + 35, y + DONKEY_HEIGHT, PIX_SRC | PIX_COLOR(COLOR_DONKEY), 2);
+    pr_vector(pr, x + 15, y + DONKEY_HEIGHT - 10, x + 15, y + DONKEY_HEIGHT, PIX_SRC | PIX_COLOR(COLOR_DONKEY), 2);
+    pr_vector(pr, x + 35, y + DONKEY_HEIGHT - 10, x + 35, y + DONKEY_HEIGHT, PIX_SRC | PIX_COLOR(COLOR_DONKEY), 2);
     
     /* Tail */
-    pw_vector(pw, x + DONKEY_WIDTH - 10, y + 15, x + DONKEY_WIDTH, y + 5, PIX_SRC | PIX_COLOR(COLOR_DONKEY), 2);
+    pr_vector(pr, x + DONKEY_WIDTH - 10, y + 15, x + DONKEY_WIDTH, y + 5, PIX_SRC | PIX_COLOR(COLOR_DONKEY), 2);
 }
 
-draw_game()
+draw_debris(pr, x, y)
+Pixrect *pr;
+int x, y;
 {
-    char score_str[40];
-    int road_left = (WINDOW_WIDTH - ROAD_WIDTH) / 2;
-    int road_right = road_left + ROAD_WIDTH;
-    int i;
+    pr_rop(pr, x, y + 2, DEBRIS_WIDTH, DEBRIS_HEIGHT - 2, PIX_SRC | PIX_COLOR(COLOR_DEBRIS), 0, 0, 0);
+    pr_rop(pr, x + 3, y, DEBRIS_WIDTH - 8, 2, PIX_SRC | PIX_COLOR(COLOR_DEBRIS), 0, 0, 0);
+    pr_vector(pr, x + 3, y + 5, x + DEBRIS_WIDTH - 4, y + 8, PIX_SRC | PIX_COLOR(COLOR_TEXT), 1);
+}
 
-    /* Clear background */
-    pw_writebackground(pw, 0, 0, WINDOW_WIDTH, WINDOW_HEIGHT, PIX_SRC | PIX_COLOR(COLOR_BACKGROUND));
+draw_object(pr, kind, x, y)
+Pixrect *pr;
+int kind, x, y;
+{
+    switch (kind) {
+        case OBJ_DONKEY:
+            draw_donkey(pr, x, y);
+            break;
+        case OBJ_CAR:
+            draw_car(pr, x, y, COLOR_TRAFFIC);
+            break;
+        case OBJ_DEBRIS:
+            draw_debris(pr, x, y);
+            break;
+    }
+}
+
+/* Draw the grass, road and markings once into road_image */
+make_scenery()
+{
+    int road_right;
+    int i, lane;
+
+    road_left = (WINDOW_WIDTH - num_lanes * LANE_WIDTH) / 2;
+    road_right = road_left + num_lanes * LANE_WIDTH;
+    font = pf_default();
+    road_image = mem_create(WINDOW_WIDTH, WINDOW_HEIGHT, pw->pw_pixrect->pr_depth);
+    frame_image = mem_create(WINDOW_WIDTH, WINDOW_HEIGHT, pw->pw_pixrect->pr_depth);
+    if (road_image == NULL || frame_image == NULL || font == NULL) {
+        fprintf(stderr, "Failed to create offscreen images\n");
+        exit(1);
+    }
 
     /* Draw grass */
-    pw_rop(pw, 0, 0, road_left, WINDOW_HEIGHT, PIX_SRC | PIX_COLOR(COLOR_GRASS), 0, 0, 0);
-    pw_rop(pw, road_right, 0, road_left, WINDOW_HEIGHT, PIX_SRC | PIX_COLOR(COLOR_GRASS), 0, 0, 0);
+    pr_rop(road_image, 0, 0, road_left, WINDOW_HEIGHT, PIX_SRC | PIX_COLOR(COLOR_GRASS), 0, 0, 0);
+    pr_rop(road_image, road_right, 0, WINDOW_WIDTH - road_right, WINDOW_HEIGHT, PIX_SRC | PIX_COLOR(COLOR_GRASS), 0, 0, 0);
 
     /* Draw road */
-    pw_rop(pw, road_left, 0, ROAD_WIDTH, WINDOW_HEIGHT, PIX_SRC | PIX_COLOR(COLOR_ROAD), 0, 0, 0);
+    pr_rop(road_image, road_left, 0, road_right - road_left, WINDOW_HEIGHT, PIX_SRC | PIX_COLOR(COLOR_ROAD), 0, 0, 0);
 
     /* Draw road markings */
-    pw_vector(pw, road_left, 0, road_left, WINDOW_HEIGHT, PIX_SRC | PIX_COLOR(COLOR_TEXT), 1);
-    pw_vector(pw, road_right, 0, road_right, WINDOW_HEIGHT, PIX_SRC | PIX_COLOR(COLOR_TEXT), 1);
+    pr_vector(road_image, road_left, 0, road_left, WINDOW_HEIGHT, PIX_SRC | PIX_COLOR(COLOR_TEXT), 1);
+    pr_vector(road_image, road_right, 0, road_right, WINDOW_HEIGHT, PIX_SRC | PIX_COLOR(COLOR_TEXT), 1);
     
-    /* Draw dashed center line */
-    for (i = 0; i < WINDOW_HEIGHT; i += 40) {
-        pw_vector(pw, WINDOW_WIDTH/2, i, WINDOW_WIDTH/2, i + 20, PIX_SRC | PIX_COLOR(COLOR_DONKEY), 1);
+    /* Draw dashed lines between the lanes */
+    for (lane = 1; lane < num_lanes; lane++) {
+        for (i = 0; i < WINDOW_HEIGHT; i += 40) {
+            pr_vector(road_image, road_left + lane * LANE_WIDTH, i, road_left + lane * LANE_WIDTH, i + 20, PIX_SRC | PIX_COLOR(COLOR_DONKEY), 1);
+        }
     }
 
-    /* Draw car */
-    draw_car(road_left + car_lane * LANE_WIDTH + (LANE_WIDTH - CAR_WIDTH)/2, WINDOW_HEIGHT - CAR_HEIGHT - 10);
+    /* Draw instructions; draw_text() puts them back over the car */
+    pr_text(road_image, SCORE_X, HELP_Y, PIX_SRC | PIX_COLOR(COLOR_TEXT), font, help_text);
 
-    /* Draw donkey */
-    draw_donkey(road_left + donkey_lane * LANE_WIDTH + (LANE_WIDTH - DONKEY_WIDTH)/2, donkey_y);
+    pr_rop(frame_image, 0, 0, WINDOW_WIDTH, WINDOW_HEIGHT, PIX_SRC, road_image, 0, 0);
+    shown_score[0] = '\0';
+    shown_boom = 0;
+    car_w = car_h = 0;
+}
 
-    /* Draw score */
-    sprintf(score_str, "Player: %d  Donkey: %d", player_score, donkey_score);
-    pw_text(pw, 10, 20, PIX_SRC | PIX_COLOR(COLOR_TEXT), 0, score_str);
+/* Put the scenery back over a rectangle of frame_image */
+restore_rect(x, y, w, h)
+int x, y, w, h;
+{
+    if (w > 0 && h > 0) {
+        pr_rop(frame_image, x, y, w, h, PIX_SRC, road_image, x, y);
+    }
+}
+
+/* Add a rectangle to blit this frame, merging it with any it touches
+   so overlapping sprites go out in one pw_rop */
+add_dirty(x, y, w, h)
+int x, y, w, h;
+{
+    int i, right, bottom;
+
+    if (x < 0) { w += x; x = 0; }
+    if (y < 0) { h += y; y = 0; }
+    if (x + w > WINDOW_WIDTH) w = WINDOW_WIDTH - x;
+    if (y + h > WINDOW_HEIGHT) h = WINDOW_HEIGHT - y;
+    if (w <= 0 || h <= 0) return;
+
+    for (i = 0; i < dirty_count; i++) {
+        if (x > dirty_x[i] + dirty_w[i] || dirty_x[i] > x + w ||
+            y > dirty_y[i] + dirty_h[i] || dirty_y[i] > y + h)
+            continue;
+        /* Take it out, grow the new one over it and start again */
+        right = x + w > dirty_x[i] + dirty_w[i] ? x + w : dirty_x[i] + dirty_w[i];
+        bottom = y + h > dirty_y[i] + dirty_h[i] ? y + h : dirty_y[i] + dirty_h[i];
+        if (dirty_x[i] < x) x = dirty_x[i];
+        if (dirty_y[i] < y) y = dirty_y[i];
+        w = right - x;
+        h = bottom - y;
+        dirty_count--;
+        dirty_x[i] = dirty_x[dirty_count];
+        dirty_y[i] = dirty_y[dirty_count];
+        dirty_w[i] = dirty_w[dirty_count];
+        dirty_h[i] = dirty_h[dirty_count];
+        i = -1;
+    }
+    if (dirty_count == MAX_DIRTY) {
+        /* Out of room: fold the last one into it */
+        dirty_count--;
+        right = x + w > dirty_x[dirty_count] + dirty_w[dirty_count] ?
+                x + w : dirty_x[dirty_count] + dirty_w[dirty_count];
+        bottom = y + h > dirty_y[dirty_count] + dirty_h[dirty_count] ?
+                 y + h : dirty_y[dirty_count] + dirty_h[dirty_count];
+        if (dirty_x[dirty_count] < x) x = dirty_x[dirty_count];
+        if (dirty_y[dirty_count] < y) y = dirty_y[dirty_count];
+        add_dirty(x, y, right - x, bottom - y);
+        return;
+    }
+    dirty_x[dirty_count] = x;
+    dirty_y[dirty_count] = y;
+    dirty_w[dirty_count] = w;
+    dirty_h[dirty_count] = h;
+    dirty_count++;
+}
 
-    /* Draw instructions */
-    pw_text(pw, 10, WINDOW_HEIGHT - 20, PIX_SRC | PIX_COLOR(COLOR_TEXT), 0, "Space: Change Lane  Q: Quit");
+/* Where text drawn at x, y with font lies */
+text_rect(x, y, str, rx, ry, rw, rh)
+int x, y;
+char *str;
+int *rx, *ry, *rw, *rh;
+{
+    struct pr_size size;
 
+    size = pf_textwidth(strlen(str), font, str);
+    *rx = x;
+    *ry = y - font->pf_defaultsize.y;
+    *rw = size.x + 2;
+    *rh = font->pf_defaultsize.y + 4;
+}
+
+/* Draw the score, instructions and BOOM into frame_image over the
+   sprites, and queue the score and BOOM if they changed */
+draw_text(score_str)
+char *score_str;
+{
+    int x, y, w, h;
+
+    pr_text(frame_image, SCORE_X, SCORE_Y, PIX_SRC | PIX_COLOR(COLOR_TEXT), font, score_str);
+    pr_text(frame_image, SCORE_X, HELP_Y, PIX_SRC | PIX_COLOR(COLOR_TEXT), font, help_text);
     if (game_over) {
-        pw_text(pw, WINDOW_WIDTH/2 - 30, WINDOW_HEIGHT/2, PIX_SRC | PIX_COLOR(COLOR_TEXT), 0, "BOOM!");
+        pr_text(frame_image, BOOM_X, BOOM_Y, PIX_SRC | PIX_COLOR(COLOR_TEXT), font, "BOOM!");
+    }
+
+    if (strcmp(score_str, shown_score) != 0) {
+        text_rect(SCORE_X, SCORE_Y, shown_score, &x, &y, &w, &h);
+        add_dirty(x, y, w, h);
+        text_rect(SCORE_X, SCORE_Y, score_str, &x, &y, &w, &h);
+        add_dirty(x, y, w, h);
+        strcpy(shown_score, score_str);
     }
+    if (game_over != shown_boom) {
+        text_rect(BOOM_X, BOOM_Y, "BOOM!", &x, &y, &w, &h);
+        add_dirty(x, y, w, h);
+        shown_boom = game_over;
+    }
+}
+
+/* Compose the next frame with the obstacles alpha / SIM_STEP of the
+   way from their previous step to their current one, and blit what
+   changed */
+draw_game(alpha)
+long alpha;
+{
+    char score_str[40];
+    int x, y, w, h, i, k, lane, kind;
+
+    /* Put the road back where the sprites and text were */
+    restore_rect(car_x, car_y, car_w, car_h);
+    for (lane = 0; lane < num_lanes; lane++) {
+        for (k = 0; k < lane_count[lane]; k++) {
+            i = LANE_SLOT(lane, k);
+            restore_rect(obj_drawn_x[i], obj_drawn_y[i], obj_drawn_w[i], obj_drawn_h[i]);
+        }
+    }
+    text_rect(SCORE_X, SCORE_Y, shown_score, &x, &y, &w, &h);
+    restore_rect(x, y, w, h);
+    text_rect(BOOM_X, BOOM_Y, "BOOM!", &x, &y, &w, &h);
+    restore_rect(x, y, w, h);
+
+    /* Draw car; the sprite's old and new places both need blitting */
+    add_dirty(car_x, car_y, car_w, car_h);
+    car_x = road_left + car_lane * LANE_WIDTH + (LANE_WIDTH - CAR_WIDTH)/2;
+    car_y = CAR_Y;
+    car_w = CAR_WIDTH;
+    car_h = CAR_HEIGHT;
+    draw_car(frame_image, car_x, car_y, COLOR_CAR);
+    add_dirty(car_x, car_y, car_w, car_h);
+
+    /* Draw obstacles, including donkey ears and the width of lines */
+    for (lane = 0; lane < num_lanes; lane++) {
+        for (k = 0; k < lane_count[lane]; k++) {
+            i = LANE_SLOT(lane, k);
+            kind = obj_kind[i];
+            add_dirty(obj_drawn_x[i], obj_drawn_y[i], obj_drawn_w[i], obj_drawn_h[i]);
+            x = road_left + lane * LANE_WIDTH + (LANE_WIDTH - kind_width[kind])/2;
+            y = obj_prev_y[i] + (int)((obj_y[i] - obj_prev_y[i]) * alpha / SIM_STEP);
+            draw_object(frame_image, kind, x, y);
+            obj_drawn_x[i] = x - 2;
+            obj_drawn_y[i] = y - 12;
+            obj_drawn_w[i] = kind_width[kind] + 4;
+            obj_drawn_h[i] = kind_height[kind] + 14;
+            add_dirty(obj_drawn_x[i], obj_drawn_y[i], obj_drawn_w[i], obj_drawn_h[i]);
+        }
+    }
+
+    /* Draw score and messages */
+    sprintf(score_str, "Player: %d  Donkey: %d", player_score, donkey_score);
+    draw_text(score_str);
+
+    blit_dirty();
+}
+
+/* Copy the rectangles changed since the last blit to the canvas */
+blit_dirty()
+{
+    int i;
+
+    for (i = 0; i < dirty_count; i++) {
+        pw_rop(pw, dirty_x[i], dirty_y[i], dirty_w[i], dirty_h[i],
+               PIX_SRC, frame_image, dirty_x[i], dirty_y[i]);
+    }
+    dirty_count = 0;
+}
+
+/* Move the car on screen now rather than at the next frame: put the
+   road back under its old and new places, draw it, draw again what
+   was over it there, and blit only that */
+redraw_car()
+{
+    int lanes[2], lane, n, k, i;
+
+    lanes[0] = (car_x - road_left) / LANE_WIDTH;
+    lanes[1] = car_lane;
+    restore_rect(car_x, car_y, car_w, car_h);
+    add_dirty(car_x, car_y, car_w, car_h);
+    car_x = road_left + car_lane * LANE_WIDTH + (LANE_WIDTH - CAR_WIDTH)/2;
+    car_y = CAR_Y;
+    car_w = CAR_WIDTH;
+    car_h = CAR_HEIGHT;
+    restore_rect(car_x, car_y, car_w, car_h);
+    add_dirty(car_x, car_y, car_w, car_h);
+    draw_car(frame_image, car_x, car_y, COLOR_CAR);
+
+    /* Obstacles stay in their lanes, so only the two lanes the car was
+       in can have any over it, and only near the bottom */
+    for (n = 0; n < 2; n++) {
+        lane = lanes[n];
+        if (lane < 0 || lane >= num_lanes || (n == 1 && lane == lanes[0])) continue;
+        for (k = 0; k < lane_count[lane]; k++) {
+            i = LANE_SLOT(lane, k);
+            if (obj_drawn_y[i] + MAX_OBJECT_HEIGHT + 14 <= CAR_Y) break;
+            if (obj_drawn_w[i] > 0 && obj_drawn_y[i] < CAR_Y + CAR_HEIGHT &&
+                obj_drawn_y[i] + obj_drawn_h[i] > CAR_Y) {
+                draw_object(frame_image, obj_kind[i], obj_drawn_x[i] + 2, obj_drawn_y[i] + 12);
+            }
+        }
+    }
+    draw_text(shown_score);
+    blit_dirty();
+}
+
+/* Put the whole of the last frame back on the canvas */
+repaint_canvas()
+{
+    pw_rop(pw, 0, 0, WINDOW_WIDTH, WINDOW_HEIGHT, PIX_SRC, frame_image, 0, 0);
+}
+
+/* Whether an obstacle in a lane is over the car at usec into the step
+   just taken, looking from the bottom of the lane up to the first one
+   that cannot reach the car.  Past SIM_STEP it looks into the step to
+   come, which is exact as each lane keeps its speed. */
+hit_car(lane, at)
+int lane;
+long at;
+{
+    int k, i, y;
+
+    for (k = 0; k < lane_count[lane]; k++) {
+        i = LANE_SLOT(lane, k);
+        y = obj_prev_y[i] + (int)((obj_y[i] - obj_prev_y[i]) * at / SIM_STEP);
+        if (y + MAX_OBJECT_HEIGHT <= CAR_Y) break;
+        if (y + kind_height[obj_kind[i]] > CAR_Y && y < CAR_Y + CAR_HEIGHT) {
+            return 1;
+        }
+    }
+    return 0;
 }
 
 update_game()
 {
+    int lane, k, i;
+
     if (game_over) {
         init_game();
         return;
     }
 
-    /* Move donkey */
-    donkey_y += 5;
+    /* Move obstacles */
+    for (lane = 0; lane < num_lanes; lane++) {
+        for (k = 0; k < lane_count[lane]; k++) {
+            i = LANE_SLOT(lane, k);
+            obj_prev_y[i] = obj_y[i];
+            obj_y[i] += lane_speed[lane];
+        }
+        lane_wait[lane] -= lane_speed[lane];
+    }
 
-    /* Check for collision */
-    if (donkey_y + DONKEY_HEIGHT > WINDOW_HEIGHT - CAR_HEIGHT - 10 && car_lane == donkey_lane) {
+    /* Check for collision in the lanes the car left and entered at the
+       moment of each lane change in this step, and where it ends up.
+       Overlaps last longer than a step, so none falls in between. */
+    while (input_count > 0 && input_at[0] <= SIM_STEP) {
+        apply_input(input_at[0]);
+    }
+    for (k = 0; k < input_count; k++) {
+        input_at[k] -= SIM_STEP;
+    }
+    if (!game_over && hit_car(sim_lane, (long) SIM_STEP)) {
         game_over = 1;
         donkey_score++;
     }
 
-    /* Check if donkey passed */
-    if (donkey_y > WINDOW_HEIGHT) {
-        donkey_y = -DONKEY_HEIGHT;
-        donkey_lane = rand() % 2;
-        player_score++;
+    /* Check for obstacles passed */
+    for (lane = 0; lane < num_lanes; lane++) {
+        while (lane_count[lane] > 0 && obj_y[LANE_SLOT(lane, 0)] > WINDOW_HEIGHT) {
+            erase_object(LANE_SLOT(lane, 0));
+            lane_first[lane] = (lane_first[lane] + 1) % LANE_SLOTS;
+            lane_count[lane]--;
+            player_score++;
+        }
     }
 
-    draw_game();
+    spawn_objects();
 }
 
 handle_input(window, event, arg)
@@ -252,19 +787,112 @@ caddr_t arg;
                 exit(0);
                 break;
             case ' ':
-                if (!game_over) {
-                    car_lane = 1 - car_lane;  /* Switch lanes */
-                }
+                steer((car_lane + 1) % num_lanes, event);  /* Switch lanes */
+                break;
+            case 'a':
+            case 'A':
+            case 'h':
+            case 'H':
+                steer(car_lane - 1, event);
+                break;
+            case 'd':
+            case 'D':
+            case 'l':
+            case 'L':
+                steer(car_lane + 1, event);
                 break;
         }
     }
 }
 
+/* Move the car to a lane as of the time of the key press, and show it
+   there straight away */
+steer(lane, event)
+int lane;
+Event *event;
+{
+    struct timeval now;
+    long at, latest;
+
+    if (game_over || lane < 0 || lane >= num_lanes || lane == car_lane) return;
+
+    gettimeofday(&now, NULL);
+    latest = sim_time + (now.tv_sec - last_frame.tv_sec) * 1000000L +
+             (now.tv_usec - last_frame.tv_usec);
+    at = sim_time + (event_time(event).tv_sec - last_frame.tv_sec) * 1000000L +
+         (event_time(event).tv_usec - last_frame.tv_usec);
+    if (at > latest) at = latest;
+    if (input_count > 0 && at < input_at[input_count - 1]) at = input_at[input_count - 1];
+    if (at < 0) at = 0;
+
+    if (input_count == MAX_INPUTS) {
+        /* Keys faster than the game steps: make the oldest happen now,
+           in the step to come that it falls in */
+        apply_input(SIM_STEP + input_at[0]);
+        if (game_over) return;
+    }
+    input_lane[input_count] = lane;
+    input_at[input_count] = at;
+    input_count++;
+
+    car_lane = lane;
+    redraw_car();
+}
+
+/* Make the oldest queued lane change at usec into the step just taken,
+   crashing if an obstacle is over the car in the lane it leaves or the
+   lane it enters */
+apply_input(at)
+long at;
+{
+    if (!game_over && (hit_car(sim_lane, at) || hit_car(input_lane[0], at))) {
+        game_over = 1;
+        donkey_score++;
+    }
+    sim_lane = input_lane[0];
+    drop_input();
+}
+
+drop_input()
+{
+    int k;
+
+    input_count--;
+    for (k = 0; k < input_count; k++) {
+        input_lane[k] = input_lane[k + 1];
+        input_at[k] = input_at[k + 1];
+    }
+}
+
 Notify_value
 game_timer(client, itimer_type)
     Notify_client client;
     int itimer_type;
 {
-    update_game();
+    struct timeval now;
+    int steps;
+
+    gettimeofday(&now, NULL);
+    sim_time += (now.tv_sec - last_frame.tv_sec) * 1000000L +
+                (now.tv_usec - last_frame.tv_usec);
+    last_frame = now;
+    if (sim_time < 0) sim_time = 0;     /* the clock was set back */
+
+    /* Catch up in whole steps; a late frame runs several, which skips
+       the frames in between instead of slowing the game */
+    for (steps = 0; sim_time >= SIM_STEP && steps < max_steps; steps++) {
+        update_game();
+        sim_time -= SIM_STEP;
+    }
+    if (sim_time >= SIM_STEP) {
+        /* Too far behind to catch up: let the game slow down, making
+           the lane changes still queued where the obstacles are now */
+        sim_time = 0;
+        while (input_count > 0) {
+            apply_input((long) SIM_STEP);
+        }
+    }
+
+    draw_game(sim_time);
     return NOTIFY_DONE;
 }
@@ -18,6 +18,12 @@
 #define PIPE_WIDTH 60
 #define GAP_HEIGHT 150
 #define NUM_COLORS 8
+#define PIPE_SPEED 2        /* pixels the playfield scrolls each frame */
+#define PIPE_SPACING 200    /* from one pipe to the next */
+#define NUM_PIPES ((WINDOW_WIDTH + PIPE_WIDTH) / PIPE_SPACING + 1)
+#define BIRD_X (WINDOW_WIDTH/4)
+#define SCORE_X 10
+#define SCORE_Y 30
 
 #define COLOR_BACKGROUND 0
 #define COLOR_BIRD 1
@@ -30,18 +36,36 @@ Pixwin *pw;
 
 int bird_y;
 float bird_velocity;
-int pipe_x;
-int pipe_gap_y;
 int score;
 int game_over;
 int cms_size;
 int flap_state;
 unsigned char red[NUM_COLORS], green[NUM_COLORS], blue[NUM_COLORS];
 
+/* The pipes are a ring from left to right: the one that scrolls off
+   the left comes round PIPE_SPACING after the last */
+int pipe_x[NUM_PIPES];
+int pipe_gap_y[NUM_PIPES];
+int first_pipe;
+
+/* What is on the canvas.  Each frame the playfield is moved left with
+   pw_copy and only the strip that scrolls in, and the bird and score
+   where they were and are now, get painted. */
+int shown;              /* 0 when the canvas needs a full draw_game() */
+int shown_bird_y;
+char shown_score[20];
+struct pixfont *font;
+
 /* Function prototypes */
 setup_colors();
 init_game();
 draw_game();
+scroll_game();
+draw_bird();
+draw_score();
+paint_area();
+bird_rect();
+score_rect();
 update_game();
 handle_input();
 Notify_value game_timer();
@@ -61,22 +85,141 @@ setup_colors()
 
 init_game()
 {
+    int i;
+
     bird_y = WINDOW_HEIGHT / 2;
     bird_velocity = 0;
-    pipe_x = WINDOW_WIDTH;
-    pipe_gap_y = WINDOW_HEIGHT / 2;
+    for (i = 0; i < NUM_PIPES; i++) {
+        pipe_x[i] = WINDOW_WIDTH + i * PIPE_SPACING;
+        pipe_gap_y[i] = rand() % (WINDOW_HEIGHT - GAP_HEIGHT) + GAP_HEIGHT/2;
+    }
+    pipe_gap_y[0] = WINDOW_HEIGHT / 2;
+    first_pipe = 0;
     score = 0;
     game_over = 0;
     flap_state = 0;
+    shown = 0;
+}
+
+/* Paint the sky and the parts of the pipes in a rectangle */
+paint_area(x, y, w, h)
+int x, y, w, h;
+{
+    int i, top, bottom, left, right;
+
+    if (x < 0) { w += x; x = 0; }
+    if (y < 0) { h += y; y = 0; }
+    if (x + w > WINDOW_WIDTH) w = WINDOW_WIDTH - x;
+    if (y + h > WINDOW_HEIGHT) h = WINDOW_HEIGHT - y;
+    if (w <= 0 || h <= 0) return;
+
+    pw_writebackground(pw, x, y, w, h, PIX_SRC | PIX_COLOR(COLOR_BACKGROUND));
+
+    for (i = 0; i < NUM_PIPES; i++) {
+        left = pipe_x[i] > x ? pipe_x[i] : x;
+        right = pipe_x[i] + PIPE_WIDTH < x + w ? pipe_x[i] + PIPE_WIDTH : x + w;
+        if (left >= right) continue;
+
+        /* Upper pipe, from the top down to the gap */
+        bottom = pipe_gap_y[i] - GAP_HEIGHT/2;
+        if (bottom > y + h) bottom = y + h;
+        if (bottom > y) {
+            pw_rop(pw, left, y, right - left, bottom - y,
+                   PIX_SRC | PIX_COLOR(COLOR_PIPE), 0, 0, 0);
+        }
+
+        /* Lower pipe, from the gap down to the bottom */
+        top = pipe_gap_y[i] + GAP_HEIGHT/2;
+        if (top < y) top = y;
+        if (top < y + h) {
+            pw_rop(pw, left, top, right - left, y + h - top,
+                   PIX_SRC | PIX_COLOR(COLOR_PIPE), 0, 0, 0);
+        }
+    }
+}
+
+/* Where the bird is drawn with its centre line at y, with room for
+   the width of its lines */
+bird_rect(y, rx, ry, rw, rh)
+int y;
+int *rx, *ry, *rw, *rh;
+{
+    *rx = BIRD_X - BIRD_WIDTH/2 - BIRD_WIDTH/4 - 2;
+    *ry = y - BIRD_HEIGHT/2 - 2;
+    *rw = BIRD_WIDTH + BIRD_WIDTH/2 + 4;
+    *rh = BIRD_HEIGHT + 4;
 }
 
+/* Where the score text lies */
+score_rect(str, rx, ry, rw, rh)
+char *str;
+int *rx, *ry, *rw, *rh;
+{
+    struct pr_size size;
+
+    size = pf_textwidth(strlen(str), font, str);
+    *rx = SCORE_X;
+    *ry = SCORE_Y - font->pf_defaultsize.y;
+    *rw = size.x + 2;
+    *rh = font->pf_defaultsize.y + 4;
+}
+
+/* Draw everything */
 draw_game()
 {
-    char score_str[20];
-    int bird_x = WINDOW_WIDTH/4;
+    paint_area(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+    draw_bird();
+    draw_score();
+    shown = 1;
+}
+
+/* Move the last frame left by PIPE_SPEED to match the pipes, then
+   paint the strip that came in on the right and the places the bird
+   and score left, and draw them again */
+scroll_game()
+{
+    int x, y, w, h;
+
+    if (!shown) {
+        draw_game();
+        return;
+    }
+
+    pw_copy(pw, 0, 0, WINDOW_WIDTH - PIPE_SPEED, WINDOW_HEIGHT, PIX_SRC,
+            pw, PIPE_SPEED, 0);
+    if (!rl_empty(&pw->pw_fixup)) {
+        /* Part of the source was hidden; repaint the lot */
+        draw_game();
+        return;
+    }
+    paint_area(WINDOW_WIDTH - PIPE_SPEED, 0, PIPE_SPEED, WINDOW_HEIGHT);
+
+    /* The bird and score were carried left with everything else */
+    bird_rect(shown_bird_y, &x, &y, &w, &h);
+    paint_area(x - PIPE_SPEED, y, w, h);
+    score_rect(shown_score, &x, &y, &w, &h);
+    paint_area(x - PIPE_SPEED, y, w, h);
+
+    draw_bird();
+    draw_score();
+}
+
+draw_score()
+{
+    sprintf(shown_score, "Score: %d", score);
+    pw_text(pw, SCORE_X, SCORE_Y, PIX_SRC | PIX_COLOR(COLOR_TEXT), font, shown_score);
+
+    if (game_over) {
+        pw_text(pw, WINDOW_WIDTH/2 - 40, WINDOW_HEIGHT/2, PIX_SRC | PIX_COLOR(COLOR_TEXT), 0, "Game Over!");
+        pw_text(pw, WINDOW_WIDTH/2 - 80, WINDOW_HEIGHT/2 + 30, PIX_SRC | PIX_COLOR(COLOR_TEXT), 0, "Press SPACE to restart");
+    }
+}
+
+draw_bird()
+{
+    int bird_x = BIRD_X;
 
-    /* Clear background */
-    pw_writebackground(pw, 0, 0, WINDOW_WIDTH, WINDOW_HEIGHT, PIX_SRC | PIX_COLOR(COLOR_BACKGROUND));
+    shown_bird_y = bird_y;
 
     /* Draw bird (old Twitter logo style) */
     /* Body */
@@ -105,52 +248,51 @@ draw_game()
         pw_vector(pw, bird_x - BIRD_WIDTH/4, bird_y, 
                   bird_x, bird_y + BIRD_HEIGHT/3, PIX_SRC | PIX_COLOR(COLOR_BIRD), 2);
     }
-
-    /* Draw pipes */
-    pw_rop(pw, pipe_x, 0, PIPE_WIDTH, pipe_gap_y - GAP_HEIGHT/2, 
-           PIX_SRC | PIX_COLOR(COLOR_PIPE), 0, 0, 0);
-    pw_rop(pw, pipe_x, pipe_gap_y + GAP_HEIGHT/2, PIPE_WIDTH, WINDOW_HEIGHT - (pipe_gap_y + GAP_HEIGHT/2), 
-           PIX_SRC | PIX_COLOR(COLOR_PIPE), 0, 0, 0);
-
-    /* Draw score */
-    sprintf(score_str, "Score: %d", score);
-    pw_text(pw, 10, 30, PIX_SRC | PIX_COLOR(COLOR_TEXT), 0, score_str);
-
-    if (game_over) {
-        pw_text(pw, WINDOW_WIDTH/2 - 40, WINDOW_HEIGHT/2, PIX_SRC | PIX_COLOR(COLOR_TEXT), 0, "Game Over!");
-        pw_text(pw, WINDOW_WIDTH/2 - 80, WINDOW_HEIGHT/2 + 30, PIX_SRC | PIX_COLOR(COLOR_TEXT), 0, "Press SPACE to restart");
-    }
 }
 
 update_game()
 {
+    int i, last;
+
     if (game_over) return;
 
     /* Update bird position */
     bird_velocity += 0.5;
     bird_y += bird_velocity;
 
-    /* Update pipe position */
-    pipe_x -= 2;
-
-    /* Check for collision or out of bounds */
-    if (bird_y - BIRD_HEIGHT/2 < 0 || bird_y + BIRD_HEIGHT/2 > WINDOW_HEIGHT ||
-        (pipe_x < WINDOW_WIDTH/4 + BIRD_WIDTH/2 && pipe_x > WINDOW_WIDTH/4 - PIPE_WIDTH - BIRD_WIDTH/2 &&
-         (bird_y - BIRD_HEIGHT/2 < pipe_gap_y - GAP_HEIGHT/2 || bird_y + BIRD_HEIGHT/2 > pipe_gap_y + GAP_HEIGHT/2))) {
+    /* Check for out of bounds */
+    if (bird_y - BIRD_HEIGHT/2 < 0 || bird_y + BIRD_HEIGHT/2 > WINDOW_HEIGHT) {
         game_over = 1;
     }
 
-    /* Check if pipe has passed */
-    if (pipe_x < 0) {
-        pipe_x = WINDOW_WIDTH;
-        pipe_gap_y = rand() % (WINDOW_HEIGHT - GAP_HEIGHT) + GAP_HEIGHT/2;
-        score++;
+    for (i = 0; i < NUM_PIPES; i++) {
+        /* Update pipe position */
+        pipe_x[i] -= PIPE_SPEED;
+
+        /* Check for collision */
+        if (pipe_x[i] < BIRD_X + BIRD_WIDTH/2 && pipe_x[i] > BIRD_X - PIPE_WIDTH - BIRD_WIDTH/2 &&
+            (bird_y - BIRD_HEIGHT/2 < pipe_gap_y[i] - GAP_HEIGHT/2 || bird_y + BIRD_HEIGHT/2 > pipe_gap_y[i] + GAP_HEIGHT/2)) {
+            game_over = 1;
+        }
+
+        /* Check if pipe has passed */
+        if (pipe_x[i] < 0 && pipe_x[i] + PIPE_SPEED >= 0) {
+            score++;
+        }
+    }
+
+    /* Send the pipe that has scrolled off round behind the last */
+    if (pipe_x[first_pipe] + PIPE_WIDTH <= 0) {
+        last = (first_pipe + NUM_PIPES - 1) % NUM_PIPES;
+        pipe_x[first_pipe] = pipe_x[last] + PIPE_SPACING;
+        pipe_gap_y[first_pipe] = rand() % (WINDOW_HEIGHT - GAP_HEIGHT) + GAP_HEIGHT/2;
+        first_pipe = (first_pipe + 1) % NUM_PIPES;
     }
 
     /* Update flap state */
     flap_state = !flap_state;
 
-    draw_game();
+    scroll_game();
 }
 
 handle_input(window, event, arg)
@@ -211,6 +353,7 @@ char **argv;
                            WIN_HEIGHT, WINDOW_HEIGHT,
                            WIN_EVENT_PROC, handle_input,
                            WIN_CONSUME_KBD_EVENTS, WIN_UP_EVENTS | WIN_ASCII_EVENTS,
+                           CANVAS_REPAINT_PROC, draw_game,
                            0);
     if (canvas == NULL) {
         fprintf(stderr, "Failed to create canvas\n");
@@ -223,6 +366,12 @@ char **argv;
         exit(1);
     }
 
+    font = pf_default();
+    if (font == NULL) {
+        fprintf(stderr, "Failed to open font\n");
+        exit(1);
+    }
+
     setup_colors();
     init_game();
     window_fit(frame);
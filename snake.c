@@ -10,16 +10,27 @@
 #include <string.h>
 #include <sys/time.h>
 
-#define WINDOW_WIDTH 500
-#define WINDOW_HEIGHT 500
-#define GRID_SIZE 25
-#define BLOCK_SIZE 20
-#define GAME_SPEED 300000  /* microseconds between moves */
+#define DEFAULT_GRID 25
+#define MIN_GRID 8
+#define MAX_GRID 200
+#define BOARD_PIXELS 500   /* blocks are sized to fit the board in about this */
+#define MAX_BLOCK 20
+#define MIN_BLOCK 3
+#define STATUS_HEIGHT 20
+#define BOARD_HEIGHT (grid_size * block_size)
+#define GAME_SPEED 300000  /* microseconds between moves at the start */
+#define MIN_SPEED 50000    /* fastest the speed curve goes */
+#define SPEED_CURVE 97     /* each food shortens the tick to this percent */
 
 #define UP    0
 #define DOWN  1
 #define LEFT  2
 #define RIGHT 3
+#define OPPOSITE(d) ((d) ^ 1)
+
+#define INPUT_QUEUE_SIZE 4
+#define STALL_LIMIT (4 * cells)  /* batch games end after this many moves without food */
+#define CUT_MARGIN 4             /* spare cells cycle shortcuts leave before the tail */
 
 #define COLOR_BLACK   0
 #define COLOR_GREEN   1
@@ -32,16 +43,78 @@ Frame frame;
 Canvas canvas;
 Pixwin *pw;
 
+/* Board geometry and speed, set from the command line */
+int grid_size = DEFAULT_GRID;
+int cells;
+int block_size;
+int cell_inset;             /* gap left around each block for the grid lines */
+int window_width, window_height;
+int start_speed = GAME_SPEED;
+int tick_usec;              /* current move interval on the speed curve */
+int timer_usec;             /* interval the itimer is programmed with */
+
 typedef struct {
     int x, y;
 } Point;
 
-Point snake[400];
+/* The body is a ring buffer: snake[snake_head] is the head and the
+   segments behind it run backwards around the ring.  occupied[] has
+   one bit per grid cell covered by the body. */
+Point *snake;
+int snake_head;
 int snake_length;
-int direction;
+unsigned char *occupied;
+
+#define SEGMENT(i) snake[(snake_head - (i) + cells) % cells]
+#define CELL_BIT(x, y) ((y) * grid_size + (x))
+#define IS_OCCUPIED(x, y) (occupied[CELL_BIT(x, y) >> 3] & (1 << (CELL_BIT(x, y) & 7)))
+#define SET_OCCUPIED(x, y) (occupied[CELL_BIT(x, y) >> 3] |= (1 << (CELL_BIT(x, y) & 7)))
+#define CLEAR_OCCUPIED(x, y) (occupied[CELL_BIT(x, y) >> 3] &= ~(1 << (CELL_BIT(x, y) & 7)))
+
+/* A set of grid cells kept as a dense list plus each cell's index in
+   that list (-1 when absent), so adding, removing and picking a random
+   member are all constant time */
+typedef struct {
+    int *cell;
+    int *pos;
+    int count;
+} CellSet;
+
+CellSet free_cells;     /* every cell not under the body */
+CellSet food_cells;     /* the free cells the food rule allows */
+int food_anywhere = 0;  /* -anywhere: no edge and corner exclusion */
+
+int direction;          /* heading of the last move made */
 Point food;
 int score;
 int game_over;
+int board_full;
+
+/* Turns typed since the last move, applied one per tick */
+int input_queue[INPUT_QUEUE_SIZE];
+int input_first;
+int input_count;
+
+/* Cells changed by the last move, redrawn by game_tick() */
+Point dirty[4];
+int dirty_count;
+
+/* Black board with the grid lines, rendered once */
+Pixrect *background;
+
+/* Autopilot state.  The BFS arrays are reused by every search; a cell
+   counts as seen or blocked only when its entry equals the current
+   stamp, so nothing needs clearing between searches. */
+int autopilot = 0;
+int *cycle_index;           /* position on the Hamiltonian cycle, -1 if off it */
+int cycle_length;
+int *bfs_queue;
+int *bfs_from;
+int *bfs_seen;
+int bfs_stamp = 0;
+int *block_mark;
+int block_stamp = 0;
+int *path;
 
 void init_game();
 void draw_game();
@@ -50,27 +123,83 @@ void generate_food();
 void check_collision();
 void handle_input();
 void draw_block();
+void draw_cell();
+void draw_status();
+void mark_dirty();
+void queue_turn();
+void next_turn();
+void init_cycle();
+int bfs();
+int neighbour();
+int step_direction();
+int tail_distance();
+int cycle_distance();
+int cycle_holes();
+int cycle_turn();
+int autopilot_turn();
+int run_batch();
+void init_background();
+void init_board();
+void set_timer();
+void set_add();
+void set_remove();
+void occupy();
+void vacate();
+int food_allowed();
 Notify_value game_tick();
 
 main(argc, argv)
 int argc;
 char **argv;
 {
-    struct itimerval timer;
     unsigned char red[8], green[8], blue[8];
 
+    int i, batch;
+
+    batch = 0;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-anywhere") == 0) {
+            food_anywhere = 1;
+        } else if (strcmp(argv[i], "-auto") == 0) {
+            autopilot = 1;
+        } else if (strcmp(argv[i], "-batch") == 0 && i + 1 < argc) {
+            batch = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-grid") == 0 && i + 1 < argc) {
+            grid_size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-speed") == 0 && i + 1 < argc) {
+            start_speed = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [-grid n] [-speed usec] [-anywhere] [-auto] [-batch games]\n",
+                    argv[0]);
+            exit(1);
+        }
+    }
+    if (grid_size < MIN_GRID || grid_size > MAX_GRID) {
+        fprintf(stderr, "grid size must be %d to %d\n", MIN_GRID, MAX_GRID);
+        exit(1);
+    }
+    if (start_speed < MIN_SPEED) start_speed = MIN_SPEED;
+
     srand(time(0));
+    init_board();
+    init_cycle();
+
+    if (batch > 0) {
+        exit(run_batch(batch));
+    }
+
     frame = window_create(NULL, FRAME,
         FRAME_LABEL,       "Snake SunView",
-        WIN_WIDTH,         WINDOW_WIDTH,
-        WIN_HEIGHT,        WINDOW_HEIGHT,
+        WIN_WIDTH,         window_width,
+        WIN_HEIGHT,        window_height,
         0);
 
     canvas = window_create(frame, CANVAS,
-        WIN_WIDTH,         WINDOW_WIDTH,
-        WIN_HEIGHT,        WINDOW_HEIGHT,
+        WIN_WIDTH,         window_width,
+        WIN_HEIGHT,        window_height,
         WIN_EVENT_PROC,    handle_input,
         WIN_CONSUME_KBD_EVENTS, WIN_UP_EVENTS | WIN_ASCII_EVENTS,
+        CANVAS_REPAINT_PROC, draw_game,
         0);
 
     pw = canvas_pixwin(canvas);
@@ -92,89 +221,191 @@ char **argv;
 
     window_fit(frame);
 
+    init_background();
     init_game();
     draw_game();
-
-    /* Set up the timer */
-    timer.it_value.tv_sec = 0;
-    timer.it_value.tv_usec = GAME_SPEED;
-    timer.it_interval.tv_sec = 0;
-    timer.it_interval.tv_usec = GAME_SPEED;
-    notify_set_itimer_func(frame, game_tick, ITIMER_REAL, &timer, NULL);
+    set_timer(tick_usec);
 
     window_main_loop(frame);
     exit(0);
 }
 
+/* Size the blocks and window for the grid and allocate everything
+   that scales with the number of cells */
+void init_board()
+{
+    cells = grid_size * grid_size;
+    block_size = BOARD_PIXELS / grid_size;
+    if (block_size > MAX_BLOCK) block_size = MAX_BLOCK;
+    if (block_size < MIN_BLOCK) block_size = MIN_BLOCK;
+    cell_inset = block_size >= 6 ? 1 : 0;
+    window_width = grid_size * block_size;
+    window_height = BOARD_HEIGHT + STATUS_HEIGHT;
+
+    snake = (Point *)malloc(cells * sizeof(Point));
+    occupied = (unsigned char *)malloc((cells + 7) / 8);
+    free_cells.cell = (int *)malloc(cells * sizeof(int));
+    free_cells.pos = (int *)malloc(cells * sizeof(int));
+    food_cells.cell = (int *)malloc(cells * sizeof(int));
+    food_cells.pos = (int *)malloc(cells * sizeof(int));
+    cycle_index = (int *)malloc(cells * sizeof(int));
+    bfs_queue = (int *)malloc(cells * sizeof(int));
+    bfs_from = (int *)malloc(cells * sizeof(int));
+    bfs_seen = (int *)calloc(cells, sizeof(int));
+    block_mark = (int *)calloc(cells, sizeof(int));
+    path = (int *)malloc(cells * sizeof(int));
+    if (snake == NULL || occupied == NULL || free_cells.cell == NULL ||
+        free_cells.pos == NULL || food_cells.cell == NULL ||
+        food_cells.pos == NULL || cycle_index == NULL || bfs_queue == NULL ||
+        bfs_from == NULL || bfs_seen == NULL || block_mark == NULL ||
+        path == NULL) {
+        fprintf(stderr, "Out of memory for a %dx%d board\n", grid_size, grid_size);
+        exit(1);
+    }
+}
+
+/* Program the move timer.  It is only reprogrammed when the interval
+   actually changes, and always from inside a tick, so the next move
+   comes one new interval after this one and the cadence never skips
+   or bunches up. */
+void set_timer(usec)
+int usec;
+{
+    struct itimerval timer;
+
+    timer_usec = usec;
+    timer.it_value.tv_sec = usec / 1000000;
+    timer.it_value.tv_usec = usec % 1000000;
+    timer.it_interval = timer.it_value;
+    notify_set_itimer_func(frame, game_tick, ITIMER_REAL, &timer, NULL);
+}
+
 void init_game()
 {
+    int i;
+
+    memset(occupied, 0, (cells + 7) / 8);
+    free_cells.count = 0;
+    food_cells.count = 0;
+    for (i = 0; i < cells; i++) {
+        free_cells.pos[i] = -1;
+        food_cells.pos[i] = -1;
+        set_add(&free_cells, i);
+        if (food_allowed(i % grid_size, i / grid_size)) {
+            set_add(&food_cells, i);
+        }
+    }
+
     snake_length = 3;
-    snake[0].x = GRID_SIZE / 2;
-    snake[0].y = GRID_SIZE / 2;
-    snake[1].x = GRID_SIZE / 2 - 1;
-    snake[1].y = GRID_SIZE / 2;
-    snake[2].x = GRID_SIZE / 2 - 2;
-    snake[2].y = GRID_SIZE / 2;
+    snake_head = snake_length - 1;
+    for (i = 0; i < snake_length; i++) {
+        SEGMENT(i).x = grid_size / 2 - i;
+        SEGMENT(i).y = grid_size / 2;
+        occupy(SEGMENT(i).x, SEGMENT(i).y);
+    }
 
     direction = RIGHT;
+    input_first = 0;
+    input_count = 0;
     score = 0;
     game_over = 0;
+    board_full = 0;
+    tick_usec = start_speed;
     generate_food();
 }
 
 void draw_block(x, y, color)
 int x, y, color;
 {
-    pw_rop(pw, x * BLOCK_SIZE + 1, y * BLOCK_SIZE + 1,
-           BLOCK_SIZE - 2, BLOCK_SIZE - 2,
+    pw_rop(pw, x * block_size + cell_inset, y * block_size + cell_inset,
+           block_size - 2 * cell_inset, block_size - 2 * cell_inset,
            PIX_SRC | PIX_COLOR(color), NULL, 0, 0);
 }
 
 void draw_food_special(x, y)
 int x, y;
 {
-    int cx = x * BLOCK_SIZE + BLOCK_SIZE/2;
-    int cy = y * BLOCK_SIZE + BLOCK_SIZE/2;
-    int radius = BLOCK_SIZE/3;
+    int cx = x * block_size + block_size/2;
+    int cy = y * block_size + block_size/2;
+    int radius = block_size/3;
     
     /* Draw bright red filled rectangle for food */
-    pw_rop(pw, x * BLOCK_SIZE + 1, y * BLOCK_SIZE + 1,
-           BLOCK_SIZE - 2, BLOCK_SIZE - 2,
-           PIX_SRC | PIX_COLOR(COLOR_RED), NULL, 0, 0);
-           
-    /* Add yellow cross to make it look like an apple */
+    draw_block(x, y, COLOR_RED);
+
+    /* Add yellow cross to make it look like an apple, if it fits */
+    if (block_size < 10) return;
     pw_vector(pw, cx - radius/2, cy, cx + radius/2, cy, 
               PIX_SRC | PIX_COLOR(COLOR_YELLOW), 2);
     pw_vector(pw, cx, cy - radius/2, cx, cy + radius/2, 
               PIX_SRC | PIX_COLOR(COLOR_YELLOW), 2);
 }
 
-void draw_game()
+void init_background()
 {
     int i;
-    char str[50];
 
-    /* Clear background to black */
-    pw_rop(pw, 0, 0, WINDOW_WIDTH, WINDOW_HEIGHT,
-           PIX_SRC | PIX_COLOR(COLOR_BLACK), NULL, 0, 0);
+    background = mem_create(window_width, window_height, pw->pw_pixrect->pr_depth);
+    if (background == NULL) {
+        fprintf(stderr, "Failed to create background\n");
+        exit(1);
+    }
 
-    /* Draw white grid lines */
-    for (i = 0; i <= GRID_SIZE; i++) {
-        pw_vector(pw, i * BLOCK_SIZE, 0, i * BLOCK_SIZE, GRID_SIZE * BLOCK_SIZE,
+    pr_rop(background, 0, 0, window_width, window_height,
+           PIX_SRC | PIX_COLOR(COLOR_BLACK), NULL, 0, 0);
+    for (i = 0; cell_inset && i <= grid_size; i++) {
+        pr_vector(background, i * block_size, 0, i * block_size, BOARD_HEIGHT,
                   PIX_SRC | PIX_COLOR(COLOR_WHITE), 1);
-        pw_vector(pw, 0, i * BLOCK_SIZE, GRID_SIZE * BLOCK_SIZE, i * BLOCK_SIZE,
+        pr_vector(background, 0, i * block_size, grid_size * block_size, i * block_size,
                   PIX_SRC | PIX_COLOR(COLOR_WHITE), 1);
     }
+}
+
+/* Repaint one grid cell from the current state */
+void draw_cell(x, y)
+int x, y;
+{
+    if (x == snake[snake_head].x && y == snake[snake_head].y) {
+        draw_block(x, y, COLOR_YELLOW);
+    } else if (IS_OCCUPIED(x, y)) {
+        draw_block(x, y, COLOR_GREEN);
+    } else {
+        pw_rop(pw, x * block_size + cell_inset, y * block_size + cell_inset,
+               block_size - 2 * cell_inset, block_size - 2 * cell_inset,
+               PIX_SRC, background, x * block_size + cell_inset, y * block_size + cell_inset);
+        if (x == food.x && y == food.y) {
+            draw_food_special(x, y);
+        }
+    }
+}
+
+void draw_status()
+{
+    char str[50];
+
+    pw_rop(pw, 0, BOARD_HEIGHT + 1, window_width, window_height - BOARD_HEIGHT - 1,
+           PIX_SRC, background, 0, BOARD_HEIGHT + 1);
+    sprintf(str, "Score: %d", score);
+    pw_text(pw, 10, window_height - 6, PIX_SRC | PIX_COLOR(COLOR_WHITE), 0, str);
+}
+
+/* Full repaint, used on canvas repaint, restart and game over */
+void draw_game()
+{
+    int i;
+    char str[50];
+
+    /* Black board and grid lines */
+    pw_rop(pw, 0, 0, window_width, window_height, PIX_SRC, background, 0, 0);
 
     if (!game_over) {
         /* Draw colorful snake */
         for (i = 0; i < snake_length; i++) {
             if (i == 0) {
                 /* Yellow head */
-                draw_block(snake[i].x, snake[i].y, COLOR_YELLOW);
+                draw_block(SEGMENT(i).x, SEGMENT(i).y, COLOR_YELLOW);
             } else {
                 /* Green body */
-                draw_block(snake[i].x, snake[i].y, COLOR_GREEN);
+                draw_block(SEGMENT(i).x, SEGMENT(i).y, COLOR_GREEN);
             }
         }
 
@@ -183,59 +414,107 @@ void draw_game()
     }
 
     /* Draw white score text */
-    sprintf(str, "Score: %d", score);
-    pw_text(pw, 10, WINDOW_HEIGHT - 30, PIX_SRC | PIX_COLOR(COLOR_WHITE), 0, str);
+    draw_status();
 
     if (game_over) {
-        pw_text(pw, WINDOW_WIDTH/2 - 50, WINDOW_HEIGHT/2, PIX_SRC | PIX_COLOR(COLOR_RED), 0, "Game Over!");
+        pw_text(pw, window_width/2 - 50, BOARD_HEIGHT/2, PIX_SRC | PIX_COLOR(COLOR_RED), 0,
+                board_full ? "Board Full!" : "Game Over!");
         sprintf(str, "Final Score: %d", score);
-        pw_text(pw, WINDOW_WIDTH/2 - 60, WINDOW_HEIGHT/2 + 20, PIX_SRC | PIX_COLOR(COLOR_WHITE), 0, str);
-        pw_text(pw, WINDOW_WIDTH/2 - 80, WINDOW_HEIGHT/2 + 40, PIX_SRC | PIX_COLOR(COLOR_WHITE), 0, "Press 'r' to restart");
+        pw_text(pw, window_width/2 - 60, BOARD_HEIGHT/2 + 20, PIX_SRC | PIX_COLOR(COLOR_WHITE), 0, str);
+        pw_text(pw, window_width/2 - 80, BOARD_HEIGHT/2 + 40, PIX_SRC | PIX_COLOR(COLOR_WHITE), 0, "Press 'r' to restart");
     }
 }
 
-void generate_food()
+void mark_dirty(p)
+Point p;
 {
-    int valid = 0;
-    int i;
+    dirty[dirty_count++] = p;
+}
 
-    while (!valid) {
-        /* Generate food away from walls and corners */
-        /* Keep food at least 2 blocks away from any edge */
-        food.x = 2 + (rand() % (GRID_SIZE - 4));
-        food.y = 2 + (rand() % (GRID_SIZE - 4));
+void set_add(set, c)
+CellSet *set;
+int c;
+{
+    set->pos[c] = set->count;
+    set->cell[set->count++] = c;
+}
 
-        valid = 1;
-        
-        /* Check if food overlaps with snake */
-        for (i = 0; i < snake_length; i++) {
-            if (snake[i].x == food.x && snake[i].y == food.y) {
-                valid = 0;
-                break;
-            }
-        }
-        
-        /* Additional check: avoid corners and edges completely */
-        if (valid) {
-            /* Avoid corners (within 2 blocks of any corner) */
-            if ((food.x <= 2 && food.y <= 2) ||                    /* top-left */
-                (food.x >= GRID_SIZE-3 && food.y <= 2) ||          /* top-right */
-                (food.x <= 2 && food.y >= GRID_SIZE-3) ||          /* bottom-left */
-                (food.x >= GRID_SIZE-3 && food.y >= GRID_SIZE-3))  /* bottom-right */
-            {
-                valid = 0;
-            }
-        }
+void set_remove(set, c)
+CellSet *set;
+int c;
+{
+    int last;
+
+    if (set->pos[c] < 0) return;
+    last = set->cell[--set->count];
+    set->cell[set->pos[c]] = last;
+    set->pos[last] = set->pos[c];
+    set->pos[c] = -1;
+}
+
+/* Keep food at least 2 blocks away from any edge and out of the
+   corners of that area, unless -anywhere was given */
+int food_allowed(x, y)
+int x, y;
+{
+    if (food_anywhere) return 1;
+
+    if (x < 2 || x > grid_size - 3 || y < 2 || y > grid_size - 3)
+        return 0;
+
+    if ((x <= 2 && y <= 2) ||                    /* top-left */
+        (x >= grid_size-3 && y <= 2) ||          /* top-right */
+        (x <= 2 && y >= grid_size-3) ||          /* bottom-left */
+        (x >= grid_size-3 && y >= grid_size-3))  /* bottom-right */
+        return 0;
+
+    return 1;
+}
+
+void occupy(x, y)
+int x, y;
+{
+    SET_OCCUPIED(x, y);
+    set_remove(&free_cells, CELL_BIT(x, y));
+    set_remove(&food_cells, CELL_BIT(x, y));
+}
+
+void vacate(x, y)
+int x, y;
+{
+    CLEAR_OCCUPIED(x, y);
+    set_add(&free_cells, CELL_BIT(x, y));
+    if (food_allowed(x, y)) {
+        set_add(&food_cells, CELL_BIT(x, y));
     }
 }
 
+/* Pick a random free cell the food rule allows, or any free cell once
+   the body covers all of those.  A body that covers the whole grid
+   ends the game. */
+void generate_food()
+{
+    CellSet *set;
+    int c;
+
+    set = food_cells.count > 0 ? &food_cells : &free_cells;
+    if (set->count == 0) {
+        board_full = 1;
+        game_over = 1;
+        return;
+    }
+
+    c = set->cell[rand() % set->count];
+    food.x = c % grid_size;
+    food.y = c / grid_size;
+}
+
 void move_snake()
 {
-    int i;
-    Point new_head;
+    Point new_head, tail;
 
-    new_head.x = snake[0].x;
-    new_head.y = snake[0].y;
+    dirty_count = 0;
+    new_head = snake[snake_head];
 
     switch (direction) {
         case UP:    new_head.y--; break;
@@ -245,34 +524,392 @@ void move_snake()
     }
 
     /* Check wall collision */
-    if (new_head.x < 0 || new_head.x >= GRID_SIZE ||
-        new_head.y < 0 || new_head.y >= GRID_SIZE) {
+    if (new_head.x < 0 || new_head.x >= grid_size ||
+        new_head.y < 0 || new_head.y >= grid_size) {
         game_over = 1;
         return;
     }
 
     /* Check self collision */
-    for (i = 0; i < snake_length; i++) {
-        if (snake[i].x == new_head.x && snake[i].y == new_head.y) {
-            game_over = 1;
-            return;
-        }
+    if (IS_OCCUPIED(new_head.x, new_head.y)) {
+        game_over = 1;
+        return;
     }
 
-    /* Move snake body */
-    for (i = snake_length - 1; i > 0; i--) {
-        snake[i] = snake[i-1];
-    }
-    snake[0] = new_head;
+    /* Advance the head; the tail stays put when the snake eats */
+    mark_dirty(snake[snake_head]);
+    mark_dirty(new_head);
+    snake_head = (snake_head + 1) % cells;
+    snake[snake_head] = new_head;
+    occupy(new_head.x, new_head.y);
 
-    /* Check food collision */
-    if (snake[0].x == food.x && snake[0].y == food.y) {
+    if (new_head.x == food.x && new_head.y == food.y) {
         snake_length++;
         score += 10;
+        tick_usec = tick_usec * SPEED_CURVE / 100;
+        if (tick_usec < MIN_SPEED) tick_usec = MIN_SPEED;
         generate_food();
+        if (!game_over) mark_dirty(food);
+    } else {
+        tail = SEGMENT(snake_length);
+        vacate(tail.x, tail.y);
+        mark_dirty(tail);
     }
 }
 
+/* Remember a turn for a later tick.  Repeats of the previous turn are
+   dropped, as is anything typed once the queue is full. */
+void queue_turn(d)
+int d;
+{
+    int last;
+
+    if (input_count == INPUT_QUEUE_SIZE) return;
+
+    if (input_count > 0) {
+        last = input_queue[(input_first + input_count - 1) % INPUT_QUEUE_SIZE];
+    } else {
+        last = direction;
+    }
+    if (d == last) return;
+
+    input_queue[(input_first + input_count) % INPUT_QUEUE_SIZE] = d;
+    input_count++;
+}
+
+/* Apply the first queued turn that is legal from the heading of the
+   last move, discarding reversals on the way */
+void next_turn()
+{
+    int d;
+
+    while (input_count > 0) {
+        d = input_queue[input_first];
+        input_first = (input_first + 1) % INPUT_QUEUE_SIZE;
+        input_count--;
+        if (d != direction && d != OPPOSITE(direction)) {
+            direction = d;
+            return;
+        }
+    }
+}
+
+/* Number the cells along a Hamiltonian cycle: right along the top
+   row, then down and up the remaining rows column by column from the
+   right, ending next to the start.  This needs an even number of
+   columns, so on odd grids the last column is left off the cycle. */
+void init_cycle()
+{
+    int x, y, w, n;
+
+    for (n = 0; n < cells; n++)
+        cycle_index[n] = -1;
+
+    w = grid_size % 2 == 0 ? grid_size : grid_size - 1;
+    n = 0;
+    for (x = 0; x < w; x++)
+        cycle_index[CELL_BIT(x, 0)] = n++;
+    for (x = w - 1; x >= 0; x--) {
+        if ((w - 1 - x) % 2 == 0) {
+            for (y = 1; y < grid_size; y++)
+                cycle_index[CELL_BIT(x, y)] = n++;
+        } else {
+            for (y = grid_size - 1; y >= 1; y--)
+                cycle_index[CELL_BIT(x, y)] = n++;
+        }
+    }
+    cycle_length = n;
+}
+
+/* Breadth-first search from cell start over cells not under the body,
+   or with simulated set, over cells not marked in block_mark[].  The
+   target cell is always enterable.  Returns the distance to target,
+   or -1 if it cannot be reached; with target -1 it returns the number
+   of cells reached.  bfs_from[] leads back from any reached cell. */
+int bfs(start, target, simulated)
+int start, target, simulated;
+{
+    int first, last, c, n, k, reached;
+
+    bfs_stamp++;
+    first = last = 0;
+    bfs_queue[last++] = start;
+    bfs_seen[start] = bfs_stamp;
+    bfs_from[start] = -1;
+    reached = 1;
+
+    while (first < last) {
+        c = bfs_queue[first++];
+        if (c == target) {
+            for (n = 0; c != start; c = bfs_from[c]) n++;
+            return n;
+        }
+        for (k = 0; k < 4; k++) {
+            n = neighbour(c, k);
+            if (n < 0) continue;
+            if (bfs_seen[n] == bfs_stamp) continue;
+            if (n != target) {
+                if (simulated ? block_mark[n] == block_stamp
+                              : IS_OCCUPIED(n % grid_size, n / grid_size)) continue;
+            }
+            bfs_seen[n] = bfs_stamp;
+            bfs_from[n] = c;
+            bfs_queue[last++] = n;
+            reached++;
+        }
+    }
+    return target < 0 ? reached : -1;
+}
+
+/* Direction of a step from cell a to the neighbouring cell b */
+int step_direction(a, b)
+int a, b;
+{
+    if (b == a - grid_size) return UP;
+    if (b == a + grid_size) return DOWN;
+    if (b == a - 1) return LEFT;
+    return RIGHT;
+}
+
+/* Neighbour of cell c in direction d, or -1 off the grid */
+int neighbour(c, d)
+int c, d;
+{
+    switch (d) {
+        case UP:    return c < grid_size ? -1 : c - grid_size;
+        case DOWN:  return c >= cells - grid_size ? -1 : c + grid_size;
+        case LEFT:  return c % grid_size == 0 ? -1 : c - 1;
+        default:    return c % grid_size == grid_size - 1 ? -1 : c + 1;
+    }
+}
+
+/* Lay out the body as it would be with the cells of path[0..n-1]
+   (newest first) added at the head and grown by grow, and return how
+   far its new tail is from path[0], or -1 if the tail is cut off.  A
+   tail right next to the head does not count, since the head may not
+   enter the cell the tail is leaving. */
+int tail_distance(n, grow)
+int n, grow;
+{
+    int i, k, c, d;
+
+    block_stamp++;
+    c = path[0];
+    for (i = 0, k = 0; i < n && k < snake_length + grow; i++, k++) {
+        c = path[i];
+        block_mark[c] = block_stamp;
+    }
+    for (i = 0; k < snake_length + grow; i++, k++) {
+        c = CELL_BIT(SEGMENT(i).x, SEGMENT(i).y);
+        block_mark[c] = block_stamp;
+    }
+    d = bfs(path[0], c, 1);
+    return d >= 2 ? d : -1;
+}
+
+/* Cells from a forward along the Hamiltonian cycle to b */
+int cycle_distance(a, b)
+int a, b;
+{
+    return (cycle_index[b] - cycle_index[a] + cycle_length) % cycle_length;
+}
+
+/* If the body lies along the cycle in order from its tail to its head,
+   return how many free cells it skips, else -1 */
+int cycle_holes()
+{
+    int i, span;
+
+    span = 0;
+    for (i = 0; i < snake_length - 1; i++) {
+        span += cycle_distance(CELL_BIT(SEGMENT(i + 1).x, SEGMENT(i + 1).y),
+                               CELL_BIT(SEGMENT(i).x, SEGMENT(i).y));
+    }
+    return span < cycle_length ? span + 1 - snake_length : -1;
+}
+
+/* Choose the next heading on a grid the cycle covers, or -1 if no move
+   keeps to the cycle.  While the body is in cycle order and the head
+   never passes the tail, the cells ahead of the head up to the tail are
+   free, so following the cycle cannot run into the body.  Shortcuts
+   skip ahead, never past the food, only when the food lies between the
+   head and the tail and the board is at least half empty.  A shortcut
+   leaves the skipped cells as holes in the body, and the gap to the
+   tail must stay CUT_MARGIN wider than all the holes: each food eaten
+   before the tail passes them narrows the gap by one. */
+int cycle_turn(head, tail, goal)
+int head, tail, goal;
+{
+    int holes, d_tail, d_food, d_next, limit, best, best_d, n, k;
+
+    holes = cycle_holes();
+    d_tail = cycle_distance(head, tail);
+    d_food = cycle_distance(head, goal);
+
+    limit = 1;
+    if (holes >= 0 && d_food < d_tail && 2 * (cells - snake_length) >= cells) {
+        limit = (d_tail - holes - CUT_MARGIN) / 2;
+        if (limit > d_food) limit = d_food;
+        if (limit < 1) limit = 1;
+    }
+
+    best = -1;
+    best_d = 0;
+    for (k = 0; k < 4; k++) {
+        n = neighbour(head, k);
+        if (n < 0 || IS_OCCUPIED(n % grid_size, n / grid_size)) continue;
+        d_next = cycle_distance(head, n);
+        if (d_next > limit || d_next <= best_d) continue;
+        if (holes < 0) {
+            /* Not in cycle order yet, as at the start: follow the cycle
+               while the tail stays in reach */
+            path[0] = n;
+            if (tail_distance(1, n == goal) < 0) continue;
+        }
+        best = k;
+        best_d = d_next;
+    }
+    return best;
+}
+
+/* Choose the next heading.  When the Hamiltonian cycle covers the
+   board, keep to it with cycle_turn().  Otherwise first try the
+   shortest path to the food, taken only if the tail can still be
+   reached once the snake has eaten there, then move along the cycle,
+   cutting ahead towards the food when that cannot pass the tail, then
+   chase the tail, and as a last resort head for the neighbour with
+   most room.  Every step except the last resort keeps the tail
+   reachable. */
+int autopilot_turn()
+{
+    int head, tail, goal, c, n, k, grow;
+    int best, best_score, score_n, d_tail, d_food, d_next;
+
+    head = CELL_BIT(snake[snake_head].x, snake[snake_head].y);
+    tail = CELL_BIT(SEGMENT(snake_length - 1).x, SEGMENT(snake_length - 1).y);
+    goal = CELL_BIT(food.x, food.y);
+
+    if (cycle_length == cells) {
+        best = cycle_turn(head, tail, goal);
+        if (best >= 0) return best;
+    } else if (bfs(head, goal, 0) > 0) {
+        for (n = 0, c = goal; c != head; c = bfs_from[c])
+            path[n++] = c;
+        c = path[n - 1];
+        if (tail_distance(n, 1) > 0)
+            return step_direction(head, c);
+    }
+
+    best = -1;
+    best_score = 0;
+    if (cycle_length < cells && cycle_index[head] >= 0 && cycle_index[tail] >= 0 &&
+        cycle_index[goal] >= 0) {
+        d_tail = cycle_distance(head, tail);
+        d_food = cycle_distance(head, goal);
+        for (k = 0; k < 4; k++) {
+            n = neighbour(head, k);
+            if (n < 0 || cycle_index[n] < 0 || IS_OCCUPIED(n % grid_size, n / grid_size)) continue;
+            d_next = cycle_distance(head, n);
+            if (d_next >= d_tail) continue;
+            /* Only cut ahead while the snake is short, never past the food */
+            if (d_next > 1 && (snake_length > cycle_length / 2 || d_next > d_food)) continue;
+            path[0] = n;
+            if (tail_distance(1, n == goal) < 0) continue;
+            if (best < 0 || d_next > best_score) {
+                best = k;
+                best_score = d_next;
+            }
+        }
+    }
+    if (best >= 0) return best;
+
+    /* Chase the tail the long way round to buy time for space to open */
+    for (k = 0; k < 4; k++) {
+        n = neighbour(head, k);
+        if (n < 0 || IS_OCCUPIED(n % grid_size, n / grid_size)) continue;
+        path[0] = n;
+        grow = n == goal;
+        score_n = tail_distance(1, grow);
+        if (score_n > best_score) {
+            best = k;
+            best_score = score_n;
+        }
+    }
+    if (best >= 0) return best;
+
+    for (k = 0; k < 4; k++) {
+        n = neighbour(head, k);
+        if (n < 0 || IS_OCCUPIED(n % grid_size, n / grid_size)) continue;
+        score_n = bfs(n, -1, 0);
+        if (best < 0 || score_n > best_score) {
+            best = k;
+            best_score = score_n;
+        }
+    }
+    return best >= 0 ? best : direction;
+}
+
+/* Play games with the autopilot and no window, then report how long
+   the snake got and how long each decision took.  Returns the exit
+   status: 1 if the cycle covers the grid but a game did not fill the
+   board, since following the cycle alone would have. */
+int run_batch(games)
+int games;
+{
+    struct timeval start, end;
+    double think_us, total_us;
+    long moves, total_moves, decisions;
+    int g, full, stalled, since_food, last_length;
+    long total_length;
+
+    full = 0;
+    stalled = 0;
+    total_length = 0;
+    total_moves = 0;
+    decisions = 0;
+    think_us = 0;
+
+    for (g = 0; g < games; g++) {
+        init_game();
+        moves = 0;
+        since_food = 0;
+        while (!game_over) {
+            gettimeofday(&start, NULL);
+            direction = autopilot_turn();
+            gettimeofday(&end, NULL);
+            think_us += (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_usec - start.tv_usec);
+            decisions++;
+
+            last_length = snake_length;
+            move_snake();
+            moves++;
+            since_food = snake_length == last_length ? since_food + 1 : 0;
+            if (since_food > STALL_LIMIT) {
+                stalled++;
+                break;
+            }
+        }
+        if (board_full) full++;
+        total_length += snake_length;
+        total_moves += moves;
+        printf("game %d: length %d moves %ld%s\n", g + 1, snake_length, moves,
+               board_full ? " (board full)" : "");
+    }
+
+    total_us = think_us / (decisions ? decisions : 1);
+    printf("%d games on %dx%d: average length %.1f of %d, average moves %.0f, "
+           "%d board full, %d stalled, %.1f us per decision\n",
+           games, grid_size, grid_size, (double)total_length / games, cells,
+           (double)total_moves / games, full, stalled, total_us);
+
+    if (cycle_length == cells && full < games) {
+        fprintf(stderr, "autopilot left %d of %d boards unfilled on a %dx%d grid\n",
+                games - full, games, grid_size, grid_size);
+        return 1;
+    }
+    return 0;
+}
+
 void handle_input(window, event, arg)
 Window window;
 Event *event;
@@ -287,6 +924,7 @@ caddr_t arg;
             if (key_id == 'r' || key_id == 'R') {
                 init_game();
                 draw_game();
+                set_timer(tick_usec);
             }
             return;
         }
@@ -296,29 +934,34 @@ caddr_t arg;
             case 'Q':
                 exit(0);
                 break;
+            case 'p':
+            case 'P':
+                autopilot = !autopilot;
+                input_count = 0;
+                break;
             case 'w':
             case 'W':
             case 'k':
             case 'K':
-                if (direction != DOWN) direction = UP;
+                queue_turn(UP);
                 break;
             case 's':
             case 'S':
             case 'j':
             case 'J':
-                if (direction != UP) direction = DOWN;
+                queue_turn(DOWN);
                 break;
             case 'a':
             case 'A':
             case 'h':
             case 'H':
-                if (direction != RIGHT) direction = LEFT;
+                queue_turn(LEFT);
                 break;
             case 'd':
             case 'D':
             case 'l':
             case 'L':
-                if (direction != LEFT) direction = RIGHT;
+                queue_turn(RIGHT);
                 break;
         }
     }
@@ -328,9 +971,31 @@ Notify_value game_tick(client, which)
     Notify_client client;
     int which;
 {
-    if (!game_over) {
-        move_snake();
+    int i, old_score;
+
+    if (game_over) return NOTIFY_DONE;
+
+    old_score = score;
+    if (autopilot) {
+        direction = autopilot_turn();
+    } else {
+        next_turn();
+    }
+    move_snake();
+    if (game_over) {
+        draw_game();
+        return NOTIFY_DONE;
+    }
+
+    /* Only the old tail, the neck, the new head and new food change */
+    for (i = 0; i < dirty_count; i++) {
+        draw_cell(dirty[i].x, dirty[i].y);
+    }
+    if (score != old_score) {
+        draw_status();
+    }
+    if (tick_usec != timer_usec) {
+        set_timer(tick_usec);
     }
-    draw_game();
     return NOTIFY_DONE;
 }
\ No newline at end of file
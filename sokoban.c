@@ -1,6 +1,7 @@
 /* Sokoban for SunOS 4 SunView
    Written by Claude, public domain
-   cc sokoban.c -o sokoban -lsuntool -lsunwindow -lpixrect */
+   cc sokoban.c -o sokoban -lsuntool -lsunwindow -lpixrect
+   levels are read from sokoban.xsb, or the pack given with -pack */
 
 #include <suntool/sunview.h>
 #include <suntool/canvas.h>
@@ -9,13 +10,64 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "levels.h"
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #define WINDOW_WIDTH 500
 #define WINDOW_HEIGHT 400
 #define CELL_SIZE 25
-#define MAX_LEVEL_WIDTH 20
-#define MAX_LEVEL_HEIGHT 20
+#define BOARD_X 30           /* window position of the viewport's top left cell */
+#define BOARD_Y 50
+#define VIEW_COLS 17         /* cells shown at once; larger levels scroll */
+#define VIEW_ROWS 11
+#define VIEW_MARGIN 3        /* cells kept between the player and the view edge */
+#define MAX_LEVEL_SIZE 256   /* widest and tallest level accepted */
+#define STATUS_HEIGHT 35     /* strip above the board holding the status line */
+#define MAX_CHANGED 64       /* cells remembered for redraw before a full repaint */
+#define DEFAULT_PACK "sokoban.xsb"
+#define SOLVER_NODES 200000  /* positions the solver may expand by default */
+#define SOLVER_INF 10000     /* push distance for cells that reach no goal */
+#define SOLVER_CELLS 65535   /* padded cells numbered by the solver's shorts */
+#define MATCH_NONE 0x3fffffff /* larger than any reduced cost in match_bound */
+#define SOLUTION_FILE "sokoban.lurd"
+#define FRAME_RATE 25        /* playback redraws per second */
+#define PLAY_RATE 10         /* moves per second for hints and solutions */
+#define REPLAY_RATE 200      /* moves per second for -replay */
+#define WALK_RATE 20         /* moves per second for mouse walks and drags */
+#define BATCH_JOBS 2         /* solver processes run at once by -batch */
+#define BATCH_TIME 60        /* seconds each level may take in -batch and -optimize */
+#define BATCH_MEMORY 64      /* megabytes of data each -batch solver may use */
+#define OPT_WINDOW 8         /* pushes in the first windows -optimize solves again */
+#define GEN_WIDTH 10         /* default size of -generate levels, walls included */
+#define GEN_HEIGHT 8
+#define GEN_BOXES 3
+#define GEN_DIFFICULTY 10    /* lowest score -generate accepts by default */
+#define GEN_PIECES 8         /* cells of room for each wall piece dropped in */
+#define GEN_PULLS 20         /* random pulls per box away from the goals */
+#define GEN_EFFORT 100       /* solver positions worth one point of score */
+#define GEN_TRIES 20         /* workers started per level before giving up */
+
+/* Directions, in the order of the LURD letters in dir_letter[] */
+#define UP 0
+#define DOWN 1
+#define LEFT 2
+#define RIGHT 3
+
+/* Cells, as written in .xsb level packs */
+#define WALL '#'
+#define BOX '$'
+#define GOAL '.'
+#define PLAYER '@'
+#define PLAYER_ON_GOAL '+'
+#define BOX_ON_GOAL '*'
+#define EMPTY ' '
 
 /* Colors */
 #define COLOR_BACKGROUND 0
@@ -27,45 +79,288 @@
 #define COLOR_TEXT 6
 #define COLOR_FLOOR 0
 
+/* Pre-rendered cell images */
+#define IMAGE_FLOOR 0
+#define IMAGE_WALL 1
+#define IMAGE_BOX 2
+#define IMAGE_GOAL 3
+#define IMAGE_BOX_ON_GOAL 4
+#define IMAGE_PLAYER 5
+#define IMAGE_COUNT 6
+
 Frame frame;
 Canvas canvas;
 Pixwin *pw;
 
 /* Game state */
-int game_grid[MAX_LEVEL_HEIGHT][MAX_LEVEL_WIDTH];
+char **game_grid;       /* rows of the level being played */
+int grid_room;          /* cells allocated behind game_grid */
 int player_x, player_y;
 int current_level = 0;
 int level_width, level_height;
 int moves = 0;
 int pushes = 0;
+int total_goals;        /* goals in the level */
+int total_boxes;
+int goals_left;         /* goals without a box, kept up to date by every move */
+int view_x, view_y;     /* level cell shown at the viewport's top left */
+int view_cols, view_rows;
+
+/* The level pack is mapped in whole and indexed once.  A level is
+   parsed the first time it is played and kept in cells[], so restarts
+   and replays only copy it. */
+typedef struct {
+    long offset;        /* first board line in the pack */
+    long length;        /* bytes up to the end of the last board line */
+    int width, height;
+    char *cells;        /* width * height cells without the player, or NULL */
+    int player_x, player_y;
+    int goals, boxes, goals_left;
+} Level;
+
+char *pack_text;
+long pack_size;
+Level *levels;
+int num_levels;
+char message[80];       /* extra status text, such as the hint result */
+
+/* Cells changed since the last redraw.  Moves add to the list and
+   draw_changes() repaints just those; if it overflows the whole
+   level is repainted instead. */
+int changed_x[MAX_CHANGED], changed_y[MAX_CHANGED];
+int changed_count;
+int changed_overflow;
+Pixrect *cell_image[IMAGE_COUNT];
+
+/* Mouse walking and box dragging.  The searches use buffers sized to
+   the largest level so far and stamps instead of clearing, so one can
+   run on every motion event.  Cells are numbered y * level_width + x. */
+int *walk_mark, walk_stamp;
+int *walk_from;                 /* direction each reached cell was entered by */
+int *walk_queue;
+char *walk_path;
+int *push_mark, push_stamp;     /* box drag states, 4 per cell */
+int *push_prev;
+int *push_queue;
+int *target_state;              /* first drag state reaching each cell */
+int *overlay_cell, overlay_count;
+int drag_box = -1;              /* cell of the box being dragged, or -1 */
+int press_cell = -1;            /* cell the button went down on */
+
+/* Deadlock warnings.  dead_cell[] marks floor from which no box can
+   be pushed to any goal; stuck_cell[] lists the boxes of the current
+   deadlock, also flagged in stuck_mark[] for drawing. */
+char *dead_cell;
+char *stuck_mark;
+int *stuck_cell, *stuck_old, stuck_count;
+int step_x[4] = { 0, 0, -1, 1 };
+int step_y[4] = { -1, 1, 0, 0 };
+int headless = 0;       /* no window: winning neither redraws nor advances */
+int level_won;
+
+/* Every move of the level so far in LURD notation, pushes in capitals.
+   move_log[0..moves-1] is the current position; the letters up to
+   log_end are moves undone and not yet replaced, for redo. */
+char *move_log;
+int log_end, log_room;
+char dir_letter[] = "udlr";
+
+/* Moves being played back: a hint, a solution, a -replay file or a
+   mouse walk */
+char *playback = NULL;
+int playback_pos;
+int playback_hint;      /* stop after the next push */
+int playback_player;    /* the player's own moves, saved on a win */
+int playback_rate;      /* moves per second */
+int playback_credit;    /* moves owed, in 1/FRAME_RATE units */
+int replay_rate = REPLAY_RATE;
+
+long solver_limit = SOLVER_NODES;
+long solver_expanded;   /* positions expanded by the last solve */
 
 /* Function prototypes */
 void init_level();
 void draw_game();
 void draw_cell();
+void draw_cells();
+void place_view();
+void follow_player();
+void draw_changes();
+void draw_status();
+void mark_changed();
+void init_images();
+void render_cell();
+void alloc_cell_buffers();
+void find_dead_cells();
+int box_stuck();
+void check_deadlock();
+int walk_flood();
+int append_walk();
+int open_cell();
+char *walk_moves();
+int push_search();
+char *drag_moves();
+void show_overlay();
+void hide_overlay();
+void handle_mouse();
 void move_player();
 void check_win();
 void handle_input();
 void parse_level();
+void load_pack();
+int board_line();
 int can_move();
 void make_move();
+int solve_level();
+void solve_levels();
+void batch_levels();
+void start_playback();
+void stop_playback();
+void show_solution();
+int letter_step();
+void undo_move();
+void redo_move();
+void save_solution();
+char *read_solution();
+char *find_solution();
+void verify_solutions();
+int record_pushes();
+char *push_moves();
+void solve_segment();
+void optimize_solutions();
+int random_room();
+void pull_boxes();
+void generate_level();
+void generate_levels();
+Notify_value play_tick();
 
 main(argc, argv)
 int argc;
 char **argv;
 {
     unsigned char red[8], green[8], blue[8];
+    int i, solve, batch, jobs, seconds, megabytes, level;
+    int generate, width, height, boxes, difficulty, seed;
+    struct timeval now;
+    char *pack, *verify, *replay, *optimize, *solution;
+
+    solve = 0;
+    batch = 0;
+    jobs = BATCH_JOBS;
+    seconds = BATCH_TIME;
+    megabytes = BATCH_MEMORY;
+    level = -1;
+    pack = DEFAULT_PACK;
+    verify = NULL;
+    replay = NULL;
+    optimize = NULL;
+    generate = 0;
+    width = GEN_WIDTH;
+    height = GEN_HEIGHT;
+    boxes = GEN_BOXES;
+    difficulty = GEN_DIFFICULTY;
+    gettimeofday(&now, NULL);
+    seed = (int)(now.tv_sec ^ getpid());
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-solve") == 0) {
+            solve = 1;
+        } else if (strcmp(argv[i], "-batch") == 0) {
+            batch = 1;
+        } else if (strcmp(argv[i], "-jobs") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-time") == 0 && i + 1 < argc) {
+            seconds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-mem") == 0 && i + 1 < argc) {
+            megabytes = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-verify") == 0 && i + 1 < argc) {
+            verify = argv[++i];
+        } else if (strcmp(argv[i], "-generate") == 0 && i + 1 < argc) {
+            generate = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-size") == 0 && i + 1 < argc &&
+                   sscanf(argv[i + 1], "%dx%d", &width, &height) == 2) {
+            i++;
+        } else if (strcmp(argv[i], "-boxes") == 0 && i + 1 < argc) {
+            boxes = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-difficulty") == 0 && i + 1 < argc) {
+            difficulty = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) {
+            seed = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-optimize") == 0 && i + 1 < argc) {
+            optimize = argv[++i];
+        } else if (strcmp(argv[i], "-replay") == 0 && i + 1 < argc) {
+            replay = argv[++i];
+        } else if (strcmp(argv[i], "-rate") == 0 && i + 1 < argc) {
+            replay_rate = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-pack") == 0 && i + 1 < argc) {
+            pack = argv[++i];
+        } else if (strcmp(argv[i], "-level") == 0 && i + 1 < argc) {
+            level = atoi(argv[++i]) - 1;
+        } else if (strcmp(argv[i], "-nodes") == 0 && i + 1 < argc) {
+            solver_limit = atol(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [-pack file] [-level n] [-replay file [-rate n]]\n"
+                    "       %s [-pack file] [-level n] -solve [-nodes n]\n"
+                    "       %s [-pack file] -batch [-jobs n] [-time secs] [-mem mb] [-nodes n]\n"
+                    "       %s [-pack file] -verify file\n"
+                    "       %s [-pack file] -optimize file [-jobs n] [-time secs] [-nodes n]\n"
+                    "       %s -generate n [-size WxH] [-boxes n] [-difficulty n] [-seed n]\n"
+                    "           [-jobs n] [-time secs] [-mem mb] [-nodes n]\n",
+                    argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+            exit(1);
+        }
+    }
+    if (generate > 0) {
+        generate_levels(generate, width, height, boxes < 1 ? 1 : boxes, difficulty,
+                        seed, jobs < 1 ? 1 : jobs, seconds, megabytes);
+        exit(0);
+    }
+    load_pack(pack);
+    if (level >= num_levels) {
+        fprintf(stderr, "There are only %d levels in %s\n", num_levels, pack);
+        exit(1);
+    }
+
+    if (replay_rate < 1) replay_rate = 1;
+
+    if (verify != NULL) {
+        verify_solutions(verify);
+        exit(0);
+    }
+    if (optimize != NULL) {
+        optimize_solutions(optimize, jobs < 1 ? 1 : jobs, seconds);
+        exit(0);
+    }
+    if (batch) {
+        batch_levels(jobs < 1 ? 1 : jobs, seconds, megabytes);
+        exit(0);
+    }
+    if (solve) {
+        solve_levels(level);
+        exit(0);
+    }
+    if (level >= 0) current_level = level;
+    solution = NULL;
+    if (replay != NULL) {
+        solution = find_solution(replay, current_level);
+        if (solution == NULL) {
+            fprintf(stderr, "No solution for level %d in %s\n", current_level + 1, replay);
+            exit(1);
+        }
+    }
 
     frame = window_create(NULL, FRAME,
         FRAME_LABEL,       "Sokoban SunView",
         WIN_WIDTH,         WINDOW_WIDTH,
         WIN_HEIGHT,        WINDOW_HEIGHT,
-        WIN_EVENT_PROC,    handle_input,
         0);
 
     canvas = window_create(frame, CANVAS,
         WIN_WIDTH,           WINDOW_WIDTH,
         WIN_HEIGHT,          WINDOW_HEIGHT,
+        WIN_EVENT_PROC,      handle_input,
+        WIN_CONSUME_KBD_EVENTS, WIN_UP_EVENTS | WIN_ASCII_EVENTS,
+        WIN_CONSUME_PICK_EVENTS, WIN_MOUSE_BUTTONS, WIN_UP_EVENTS,
+                             LOC_MOVE, LOC_DRAG, LOC_WINEXIT, 0,
         CANVAS_REPAINT_PROC, draw_game,
         0);
 
@@ -89,165 +384,319 @@ char **argv;
     pw_putcolormap(pw, 0, 8, red, green, blue);
 
     window_fit(frame);
+    init_images();
     init_level();
+    if (solution != NULL) start_playback(solution, 0, replay_rate, 0);
     draw_game();
 
     window_main_loop(frame);
     return 0;
 }
 
-void parse_level()
+/* Whether the line at p is part of a board: nothing but cell
+   characters, with at least one wall.  Sets *len to its length. */
+int board_line(p, end, len)
+char *p, *end;
+int *len;
 {
-    char *level_data;
-    int x, y, i;
-    char c;
+    int n, walls;
+
+    walls = 0;
+    for (n = 0; p + n < end && p[n] != '\n'; n++) {
+        switch (p[n]) {
+            case WALL:
+                walls++;
+                break;
+            case BOX: case GOAL: case PLAYER: case PLAYER_ON_GOAL:
+            case BOX_ON_GOAL: case EMPTY: case '-': case '_': case '\r':
+                break;
+            default:
+                walls = -1;
+                break;
+        }
+        if (walls < 0) break;
+    }
+    while (p + n < end && p[n] != '\n') n++;
+    *len = n;
+    return walls > 0;
+}
 
-    level_data = levels[current_level].data;
-    level_width = 0;
-    level_height = 0;
-    x = 0;
-    y = 0;
+/* Map a level pack and note where each level starts.  Levels are runs
+   of board lines; titles, comments and blank lines separate them. */
+void load_pack(path)
+char *path;
+{
+    struct stat st;
+    char *p, *end;
+    int fd, len, room, width;
+    Level *level;
 
-    /* Clear grid */
-    for (i = 0; i < MAX_LEVEL_HEIGHT; i++) {
-        memset(game_grid[i], EMPTY, MAX_LEVEL_WIDTH * sizeof(int));
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        exit(1);
+    }
+    pack_size = st.st_size;
+    pack_text = (char *)mmap((caddr_t)0, (int)pack_size, PROT_READ, MAP_PRIVATE, fd, (off_t)0);
+    if (pack_text == (char *)-1) {
+        perror(path);
+        exit(1);
     }
+    close(fd);
 
-    /* Parse level string */
-    i = 0;
-    while ((c = level_data[i++]) != '\0') {
-        if (c == '\n') {
-            if (x > level_width) level_width = x;
-            y++;
-            x = 0;
+    room = 64;
+    levels = (Level *)malloc(room * sizeof(Level));
+    num_levels = 0;
+    level = NULL;
+    end = pack_text + pack_size;
+    for (p = pack_text; p < end; p += len + 1) {
+        if (!board_line(p, end, &len)) {
+            level = NULL;
             continue;
         }
+        if (level == NULL) {
+            if (num_levels == room) {
+                room *= 2;
+                levels = (Level *)realloc((char *)levels, room * sizeof(Level));
+            }
+            if (levels == NULL) {
+                fprintf(stderr, "Out of memory indexing %s\n", path);
+                exit(1);
+            }
+            level = &levels[num_levels++];
+            level->offset = p - pack_text;
+            level->width = 0;
+            level->height = 0;
+            level->cells = NULL;
+        }
+        width = len;
+        if (width > 0 && p[width - 1] == '\r') width--;
+        if (width > level->width) level->width = width;
+        level->height++;
+        level->length = p + len - pack_text - level->offset;
+        if (level->width > MAX_LEVEL_SIZE || level->height > MAX_LEVEL_SIZE) {
+            fprintf(stderr, "Level %d of %s is larger than %dx%d\n",
+                    num_levels, path, MAX_LEVEL_SIZE, MAX_LEVEL_SIZE);
+            exit(1);
+        }
+    }
 
-        switch (c) {
-            case WALL:
-                game_grid[y][x] = WALL;
-                break;
-            case BOX:
-                game_grid[y][x] = BOX;
-                break;
-            case GOAL:
-                game_grid[y][x] = GOAL;
-                break;
-            case PLAYER:
-                game_grid[y][x] = EMPTY;
-                player_x = x;
-                player_y = y;
-                break;
-            case PLAYER_ON_GOAL:
-                game_grid[y][x] = GOAL;
-                player_x = x;
-                player_y = y;
-                break;
-            case BOX_ON_GOAL:
-                game_grid[y][x] = BOX_ON_GOAL;
-                break;
-            case EMPTY:
-            default:
-                game_grid[y][x] = EMPTY;
-                break;
+    if (num_levels == 0) {
+        fprintf(stderr, "No levels in %s\n", path);
+        exit(1);
+    }
+}
+
+/* Set up game_grid from the current level, parsing it on first use */
+void parse_level()
+{
+    Level *level;
+    char *p, *end, *cells, c;
+    int x, y, i;
+
+    level = &levels[current_level];
+    if (level->cells == NULL) {
+        cells = (char *)malloc(level->width * level->height);
+        if (cells == NULL) {
+            fprintf(stderr, "Out of memory for level %d\n", current_level + 1);
+            exit(1);
         }
-        x++;
+        memset(cells, EMPTY, level->width * level->height);
+        level->player_x = level->player_y = 0;
+        level->goals = level->boxes = level->goals_left = 0;
+        p = pack_text + level->offset;
+        end = p + level->length;
+        for (x = 0, y = 0; p < end; p++) {
+            c = *p;
+            if (c == '\n') {
+                y++;
+                x = 0;
+                continue;
+            }
+            switch (c) {
+                case PLAYER:
+                    c = EMPTY;
+                    level->player_x = x;
+                    level->player_y = y;
+                    break;
+                case PLAYER_ON_GOAL:
+                    c = GOAL;
+                    level->player_x = x;
+                    level->player_y = y;
+                    break;
+                case WALL: case BOX: case GOAL: case BOX_ON_GOAL:
+                    break;
+                default:
+                    c = EMPTY;
+                    break;
+            }
+            if (x < level->width) {
+                cells[y * level->width + x] = c;
+                if (c == GOAL || c == BOX_ON_GOAL) level->goals++;
+                if (c == BOX || c == BOX_ON_GOAL) level->boxes++;
+                if (c == GOAL) level->goals_left++;
+            }
+            x++;
+        }
+        level->cells = cells;
+    }
+
+    level_width = level->width;
+    level_height = level->height;
+    player_x = level->player_x;
+    player_y = level->player_y;
+    total_goals = level->goals;
+    total_boxes = level->boxes;
+    goals_left = level->goals_left;
+
+    /* Rows of game_grid point into one block, grown only for a larger level */
+    if (level_width * level_height > grid_room || game_grid == NULL) {
+        if (game_grid != NULL) {
+            free(game_grid[0]);
+            free((char *)game_grid);
+        }
+        grid_room = level_width * level_height;
+        game_grid = (char **)malloc(level_height * sizeof(char *));
+        if (game_grid != NULL) game_grid[0] = (char *)malloc(grid_room);
+        if (game_grid == NULL || game_grid[0] == NULL) {
+            fprintf(stderr, "Out of memory for level %d\n", current_level + 1);
+            exit(1);
+        }
+        alloc_cell_buffers();
+    } else {
+        game_grid = (char **)realloc((char *)game_grid, level_height * sizeof(char *));
+    }
+    for (i = 1; i < level_height; i++) {
+        game_grid[i] = game_grid[0] + i * level_width;
     }
-    level_height = y + 1;
-    if (x > level_width) level_width = x;
+    memcpy(game_grid[0], level->cells, level_width * level_height);
 }
 
 void init_level()
 {
+    stop_playback();
     moves = 0;
     pushes = 0;
+    log_end = 0;
+    level_won = 0;
+    changed_count = 0;
+    changed_overflow = 0;
+    overlay_count = 0;
+    drag_box = -1;
+    press_cell = -1;
+    message[0] = '\0';
     parse_level();
+    find_dead_cells();
+    place_view();
 }
 
-void draw_cell(x, y, cell_type)
-int x, y, cell_type;
+/* Draw one cell type into a CELL_SIZE square memory pixrect */
+void render_cell(pr, cell_type)
+Pixrect *pr;
+int cell_type;
 {
-    int screen_x, screen_y, cx, cy;
+    int cx, cy;
 
-    screen_x = x * CELL_SIZE + 30;
-    screen_y = y * CELL_SIZE + 50;
-    cx = screen_x + CELL_SIZE / 2;
-    cy = screen_y + CELL_SIZE / 2;
+    cx = CELL_SIZE / 2;
+    cy = CELL_SIZE / 2;
 
     /* Draw floor background first */
-    pw_rop(pw, screen_x, screen_y, CELL_SIZE, CELL_SIZE,
+    pr_rop(pr, 0, 0, CELL_SIZE, CELL_SIZE,
            PIX_SRC | PIX_COLOR(COLOR_FLOOR), NULL, 0, 0);
 
     switch (cell_type) {
         case WALL:
             /* Draw brick pattern */
-            pw_rop(pw, screen_x, screen_y, CELL_SIZE, CELL_SIZE,
+            pr_rop(pr, 0, 0, CELL_SIZE, CELL_SIZE,
                    PIX_SRC | PIX_COLOR(COLOR_WALL), NULL, 0, 0);
             /* Add brick lines */
-            pw_vector(pw, screen_x, screen_y + CELL_SIZE/3, screen_x + CELL_SIZE, screen_y + CELL_SIZE/3,
+            pr_vector(pr, 0, CELL_SIZE/3, CELL_SIZE, CELL_SIZE/3,
                       PIX_SRC | PIX_COLOR(COLOR_BACKGROUND), 1);
-            pw_vector(pw, screen_x, screen_y + 2*CELL_SIZE/3, screen_x + CELL_SIZE, screen_y + 2*CELL_SIZE/3,
+            pr_vector(pr, 0, 2*CELL_SIZE/3, CELL_SIZE, 2*CELL_SIZE/3,
                       PIX_SRC | PIX_COLOR(COLOR_BACKGROUND), 1);
-            pw_vector(pw, screen_x + CELL_SIZE/2, screen_y, screen_x + CELL_SIZE/2, screen_y + CELL_SIZE/3,
+            pr_vector(pr, CELL_SIZE/2, 0, CELL_SIZE/2, CELL_SIZE/3,
                       PIX_SRC | PIX_COLOR(COLOR_BACKGROUND), 1);
-            pw_vector(pw, screen_x + CELL_SIZE/4, screen_y + CELL_SIZE/3, screen_x + CELL_SIZE/4, screen_y + 2*CELL_SIZE/3,
+            pr_vector(pr, CELL_SIZE/4, CELL_SIZE/3, CELL_SIZE/4, 2*CELL_SIZE/3,
                       PIX_SRC | PIX_COLOR(COLOR_BACKGROUND), 1);
-            pw_vector(pw, screen_x + 3*CELL_SIZE/4, screen_y + CELL_SIZE/3, screen_x + 3*CELL_SIZE/4, screen_y + 2*CELL_SIZE/3,
+            pr_vector(pr, 3*CELL_SIZE/4, CELL_SIZE/3, 3*CELL_SIZE/4, 2*CELL_SIZE/3,
                       PIX_SRC | PIX_COLOR(COLOR_BACKGROUND), 1);
-            pw_vector(pw, screen_x + CELL_SIZE/2, screen_y + 2*CELL_SIZE/3, screen_x + CELL_SIZE/2, screen_y + CELL_SIZE,
+            pr_vector(pr, CELL_SIZE/2, 2*CELL_SIZE/3, CELL_SIZE/2, CELL_SIZE,
                       PIX_SRC | PIX_COLOR(COLOR_BACKGROUND), 1);
             break;
         case BOX:
             /* Draw crate with wood grain */
-            pw_rop(pw, screen_x + 2, screen_y + 2, CELL_SIZE - 4, CELL_SIZE - 4,
+            pr_rop(pr, 2, 2, CELL_SIZE - 4, CELL_SIZE - 4,
                    PIX_SRC | PIX_COLOR(COLOR_BOX), NULL, 0, 0);
             /* Draw crate edges */
-            pw_vector(pw, screen_x + 2, screen_y + 2, screen_x + CELL_SIZE - 2, screen_y + 2,
+            pr_vector(pr, 2, 2, CELL_SIZE - 2, 2,
                       PIX_SRC | PIX_COLOR(COLOR_BACKGROUND), 2);
-            pw_vector(pw, screen_x + 2, screen_y + 2, screen_x + 2, screen_y + CELL_SIZE - 2,
+            pr_vector(pr, 2, 2, 2, CELL_SIZE - 2,
                       PIX_SRC | PIX_COLOR(COLOR_BACKGROUND), 2);
-            pw_vector(pw, screen_x + CELL_SIZE - 2, screen_y + 2, screen_x + CELL_SIZE - 2, screen_y + CELL_SIZE - 2,
+            pr_vector(pr, CELL_SIZE - 2, 2, CELL_SIZE - 2, CELL_SIZE - 2,
                       PIX_SRC | PIX_COLOR(COLOR_BACKGROUND), 2);
-            pw_vector(pw, screen_x + 2, screen_y + CELL_SIZE - 2, screen_x + CELL_SIZE - 2, screen_y + CELL_SIZE - 2,
+            pr_vector(pr, 2, CELL_SIZE - 2, CELL_SIZE - 2, CELL_SIZE - 2,
                       PIX_SRC | PIX_COLOR(COLOR_BACKGROUND), 2);
             /* Draw wood grain lines */
-            pw_vector(pw, screen_x + 6, screen_y + 6, screen_x + CELL_SIZE - 6, screen_y + 6,
+            pr_vector(pr, 6, 6, CELL_SIZE - 6, 6,
                       PIX_SRC | PIX_COLOR(COLOR_BACKGROUND), 1);
-            pw_vector(pw, screen_x + 6, screen_y + CELL_SIZE/2, screen_x + CELL_SIZE - 6, screen_y + CELL_SIZE/2,
+            pr_vector(pr, 6, CELL_SIZE/2, CELL_SIZE - 6, CELL_SIZE/2,
                       PIX_SRC | PIX_COLOR(COLOR_BACKGROUND), 1);
-            pw_vector(pw, screen_x + 6, screen_y + CELL_SIZE - 6, screen_x + CELL_SIZE - 6, screen_y + CELL_SIZE - 6,
+            pr_vector(pr, 6, CELL_SIZE - 6, CELL_SIZE - 6, CELL_SIZE - 6,
                       PIX_SRC | PIX_COLOR(COLOR_BACKGROUND), 1);
             break;
         case GOAL:
             /* Draw target as crosshairs */
-            pw_vector(pw, cx - 8, cy, cx + 8, cy,
+            pr_vector(pr, cx - 8, cy, cx + 8, cy,
                       PIX_SRC | PIX_COLOR(COLOR_TARGET), 2);
-            pw_vector(pw, cx, cy - 8, cx, cy + 8,
+            pr_vector(pr, cx, cy - 8, cx, cy + 8,
                       PIX_SRC | PIX_COLOR(COLOR_TARGET), 2);
             /* Draw target rings */
-            pw_rop(pw, cx - 6, cy - 6, 12, 12,
+            pr_rop(pr, cx - 6, cy - 6, 12, 12,
                    PIX_SRC | PIX_COLOR(COLOR_TARGET), NULL, 0, 0);
-            pw_rop(pw, cx - 3, cy - 3, 6, 6,
+            pr_rop(pr, cx - 3, cy - 3, 6, 6,
                    PIX_SRC | PIX_COLOR(COLOR_FLOOR), NULL, 0, 0);
             break;
         case BOX_ON_GOAL:
             /* Draw target underneath */
-            pw_vector(pw, cx - 8, cy, cx + 8, cy,
+            pr_vector(pr, cx - 8, cy, cx + 8, cy,
                       PIX_SRC | PIX_COLOR(COLOR_TARGET), 2);
-            pw_vector(pw, cx, cy - 8, cx, cy + 8,
+            pr_vector(pr, cx, cy - 8, cx, cy + 8,
                       PIX_SRC | PIX_COLOR(COLOR_TARGET), 2);
             /* Draw crate on top with different color */
-            pw_rop(pw, screen_x + 2, screen_y + 2, CELL_SIZE - 4, CELL_SIZE - 4,
+            pr_rop(pr, 2, 2, CELL_SIZE - 4, CELL_SIZE - 4,
                    PIX_SRC | PIX_COLOR(COLOR_BOX_ON_TARGET), NULL, 0, 0);
-            pw_vector(pw, screen_x + 2, screen_y + 2, screen_x + CELL_SIZE - 2, screen_y + 2,
+            pr_vector(pr, 2, 2, CELL_SIZE - 2, 2,
                       PIX_SRC | PIX_COLOR(COLOR_TEXT), 2);
-            pw_vector(pw, screen_x + 2, screen_y + 2, screen_x + 2, screen_y + CELL_SIZE - 2,
+            pr_vector(pr, 2, 2, 2, CELL_SIZE - 2,
                       PIX_SRC | PIX_COLOR(COLOR_TEXT), 2);
-            pw_vector(pw, screen_x + CELL_SIZE - 2, screen_y + 2, screen_x + CELL_SIZE - 2, screen_y + CELL_SIZE - 2,
+            pr_vector(pr, CELL_SIZE - 2, 2, CELL_SIZE - 2, CELL_SIZE - 2,
                       PIX_SRC | PIX_COLOR(COLOR_TEXT), 2);
-            pw_vector(pw, screen_x + 2, screen_y + CELL_SIZE - 2, screen_x + CELL_SIZE - 2, screen_y + CELL_SIZE - 2,
+            pr_vector(pr, 2, CELL_SIZE - 2, CELL_SIZE - 2, CELL_SIZE - 2,
                       PIX_SRC | PIX_COLOR(COLOR_TEXT), 2);
             break;
+        case PLAYER:
+            /* Stick figure: head */
+            pr_rop(pr, cx - 4, 4, 8, 8,
+                   PIX_SRC | PIX_COLOR(COLOR_PLAYER), NULL, 0, 0);
+            pr_vector(pr, cx - 3, 5, cx + 3, 5,
+                      PIX_SRC | PIX_COLOR(COLOR_FLOOR), 1);
+            pr_vector(pr, cx - 3, 10, cx + 3, 10,
+                      PIX_SRC | PIX_COLOR(COLOR_FLOOR), 1);
+
+            /* Draw body */
+            pr_vector(pr, cx, 12, cx, CELL_SIZE - 6,
+                      PIX_SRC | PIX_COLOR(COLOR_PLAYER), 2);
+
+            /* Draw arms */
+            pr_vector(pr, cx - 6, 15, cx + 6, 15,
+                      PIX_SRC | PIX_COLOR(COLOR_PLAYER), 2);
+
+            /* Draw legs */
+            pr_vector(pr, cx, CELL_SIZE - 6, cx - 4, CELL_SIZE - 2,
+                      PIX_SRC | PIX_COLOR(COLOR_PLAYER), 2);
+            pr_vector(pr, cx, CELL_SIZE - 6, cx + 4, CELL_SIZE - 2,
+                      PIX_SRC | PIX_COLOR(COLOR_PLAYER), 2);
+            break;
         case EMPTY:
         default:
             /* Just floor, already drawn above */
@@ -255,61 +704,239 @@ int x, y, cell_type;
     }
 }
 
-void draw_game()
+/* Render every cell type once so a cell costs a single pw_rop
+   instead of up to eight vectors */
+void init_images()
 {
-    int x, y;
-    char status[100];
+    static int types[IMAGE_COUNT] = { EMPTY, WALL, BOX, GOAL, BOX_ON_GOAL, PLAYER };
+    int i;
 
-    /* Clear background */
-    pw_rop(pw, 0, 0, WINDOW_WIDTH, WINDOW_HEIGHT,
-           PIX_SRC | PIX_COLOR(COLOR_BACKGROUND), NULL, 0, 0);
+    for (i = 0; i < IMAGE_COUNT; i++) {
+        cell_image[i] = mem_create(CELL_SIZE, CELL_SIZE, pw->pw_pixrect->pr_depth);
+        if (cell_image[i] == NULL) {
+            fprintf(stderr, "Failed to create cell image\n");
+            exit(1);
+        }
+        render_cell(cell_image[i], types[i]);
+    }
+}
+
+/* Size the per-cell buffers used while playing for grid_room cells */
+void alloc_cell_buffers()
+{
+    if (walk_mark != NULL) {
+        free((char *)walk_mark);
+        free((char *)walk_from);
+        free((char *)walk_queue);
+        free(walk_path);
+        free((char *)push_mark);
+        free((char *)push_prev);
+        free((char *)push_queue);
+        free((char *)target_state);
+        free((char *)overlay_cell);
+        free(dead_cell);
+        free(stuck_mark);
+        free((char *)stuck_cell);
+        free((char *)stuck_old);
+    }
+    walk_mark = (int *)calloc(grid_room, sizeof(int));
+    walk_from = (int *)malloc(grid_room * sizeof(int));
+    walk_queue = (int *)malloc(grid_room * sizeof(int));
+    walk_path = (char *)malloc(grid_room + 1);
+    push_mark = (int *)calloc(4 * grid_room, sizeof(int));
+    push_prev = (int *)malloc(4 * grid_room * sizeof(int));
+    push_queue = (int *)malloc(4 * grid_room * sizeof(int));
+    target_state = (int *)malloc(grid_room * sizeof(int));
+    overlay_cell = (int *)malloc(grid_room * sizeof(int));
+    dead_cell = (char *)malloc(grid_room);
+    stuck_mark = (char *)calloc(grid_room, 1);
+    stuck_cell = (int *)malloc(grid_room * sizeof(int));
+    stuck_old = (int *)malloc((grid_room + 1) * sizeof(int));
+    if (walk_mark == NULL || walk_from == NULL || walk_queue == NULL ||
+        walk_path == NULL || push_mark == NULL || push_prev == NULL ||
+        push_queue == NULL || target_state == NULL || overlay_cell == NULL ||
+        dead_cell == NULL || stuck_mark == NULL || stuck_cell == NULL ||
+        stuck_old == NULL) {
+        fprintf(stderr, "Out of memory for level %d\n", current_level + 1);
+        exit(1);
+    }
+    walk_stamp = 0;
+    push_stamp = 0;
+}
+
+/* Draw one level cell if it is inside the viewport */
+void draw_cell(x, y)
+int x, y;
+{
+    int image, px, py;
+
+    if (x < view_x || x >= view_x + view_cols || y < view_y || y >= view_y + view_rows)
+        return;
+    px = (x - view_x) * CELL_SIZE + BOARD_X;
+    py = (y - view_y) * CELL_SIZE + BOARD_Y;
 
-    /* Draw level */
-    for (y = 0; y < level_height; y++) {
-        for (x = 0; x < level_width; x++) {
-            draw_cell(x, y, game_grid[y][x]);
+    if (x == player_x && y == player_y) {
+        image = IMAGE_PLAYER;
+    } else {
+        switch (game_grid[y][x]) {
+            case WALL:        image = IMAGE_WALL; break;
+            case BOX:         image = IMAGE_BOX; break;
+            case GOAL:        image = IMAGE_GOAL; break;
+            case BOX_ON_GOAL: image = IMAGE_BOX_ON_GOAL; break;
+            default:          image = IMAGE_FLOOR; break;
         }
     }
+    pw_rop(pw, px, py, CELL_SIZE, CELL_SIZE, PIX_SRC, cell_image[image], 0, 0);
 
-    /* Draw player as stick figure */
-    draw_cell(player_x, player_y, EMPTY);
-    {
-        int px, py, pcx, pcy;
-        px = player_x * CELL_SIZE + 30;
-        py = player_y * CELL_SIZE + 50;
-        pcx = px + CELL_SIZE / 2;
-        pcy = py + CELL_SIZE / 2;
+    /* Cross out boxes that can no longer reach a goal */
+    if (stuck_mark[y * level_width + x]) {
+        pw_vector(pw, px + 4, py + 4, px + CELL_SIZE - 5, py + CELL_SIZE - 5,
+                  PIX_SRC | PIX_COLOR(COLOR_TARGET), 2);
+        pw_vector(pw, px + CELL_SIZE - 5, py + 4, px + 4, py + CELL_SIZE - 5,
+                  PIX_SRC | PIX_COLOR(COLOR_TARGET), 2);
+    }
+}
+
+/* Draw the cells from (x0, y0) up to but not including (x1, y1) */
+void draw_cells(x0, y0, x1, y1)
+int x0, y0, x1, y1;
+{
+    int x, y;
+
+    for (y = y0; y < y1; y++) {
+        for (x = x0; x < x1; x++) {
+            draw_cell(x, y);
+        }
+    }
+}
+
+/* Size the viewport for the level and centre it on the player */
+void place_view()
+{
+    view_cols = level_width < VIEW_COLS ? level_width : VIEW_COLS;
+    view_rows = level_height < VIEW_ROWS ? level_height : VIEW_ROWS;
+    view_x = player_x - view_cols / 2;
+    view_y = player_y - view_rows / 2;
+    if (view_x > level_width - view_cols) view_x = level_width - view_cols;
+    if (view_y > level_height - view_rows) view_y = level_height - view_rows;
+    if (view_x < 0) view_x = 0;
+    if (view_y < 0) view_y = 0;
+}
 
-        /* Draw head (circle) */
-        pw_rop(pw, pcx - 4, py + 4, 8, 8,
-               PIX_SRC | PIX_COLOR(COLOR_PLAYER), NULL, 0, 0);
-        pw_vector(pw, pcx - 3, py + 5, pcx + 3, py + 5,
-                  PIX_SRC | PIX_COLOR(COLOR_FLOOR), 1);
-        pw_vector(pw, pcx - 3, py + 10, pcx + 3, py + 10,
-                  PIX_SRC | PIX_COLOR(COLOR_FLOOR), 1);
+/* Keep the player VIEW_MARGIN cells inside the viewport.  With
+   scroll set, the cells still in view are moved with pw_copy and only
+   the strips that come into view are drawn; otherwise the caller
+   repaints the board. */
+void follow_player(scroll)
+int scroll;
+{
+    int margin, x, y, dx, dy, w, h;
+
+    x = view_x;
+    margin = view_cols > 2 * VIEW_MARGIN ? VIEW_MARGIN : (view_cols - 1) / 2;
+    if (player_x < x + margin) x = player_x - margin;
+    if (player_x >= x + view_cols - margin) x = player_x - view_cols + margin + 1;
+    if (x > level_width - view_cols) x = level_width - view_cols;
+    if (x < 0) x = 0;
 
-        /* Draw body */
-        pw_vector(pw, pcx, py + 12, pcx, py + CELL_SIZE - 6,
-                  PIX_SRC | PIX_COLOR(COLOR_PLAYER), 2);
+    y = view_y;
+    margin = view_rows > 2 * VIEW_MARGIN ? VIEW_MARGIN : (view_rows - 1) / 2;
+    if (player_y < y + margin) y = player_y - margin;
+    if (player_y >= y + view_rows - margin) y = player_y - view_rows + margin + 1;
+    if (y > level_height - view_rows) y = level_height - view_rows;
+    if (y < 0) y = 0;
 
-        /* Draw arms */
-        pw_vector(pw, pcx - 6, py + 15, pcx + 6, py + 15,
-                  PIX_SRC | PIX_COLOR(COLOR_PLAYER), 2);
+    dx = x - view_x;
+    dy = y - view_y;
+    if (dx == 0 && dy == 0) return;
+    view_x = x;
+    view_y = y;
+    if (!scroll) return;
+    if (dx >= view_cols || -dx >= view_cols || dy >= view_rows || -dy >= view_rows) {
+        draw_cells(view_x, view_y, view_x + view_cols, view_y + view_rows);
+        return;
+    }
 
-        /* Draw legs */
-        pw_vector(pw, pcx, py + CELL_SIZE - 6, pcx - 4, py + CELL_SIZE - 2,
-                  PIX_SRC | PIX_COLOR(COLOR_PLAYER), 2);
-        pw_vector(pw, pcx, py + CELL_SIZE - 6, pcx + 4, py + CELL_SIZE - 2,
-                  PIX_SRC | PIX_COLOR(COLOR_PLAYER), 2);
+    w = (view_cols - (dx > 0 ? dx : -dx)) * CELL_SIZE;
+    h = (view_rows - (dy > 0 ? dy : -dy)) * CELL_SIZE;
+    pw_copy(pw, BOARD_X + (dx < 0 ? -dx : 0) * CELL_SIZE,
+            BOARD_Y + (dy < 0 ? -dy : 0) * CELL_SIZE, w, h, PIX_SRC,
+            pw, BOARD_X + (dx > 0 ? dx : 0) * CELL_SIZE,
+            BOARD_Y + (dy > 0 ? dy : 0) * CELL_SIZE);
+    if (!rl_empty(&pw->pw_fixup)) {
+        /* Part of the source was hidden; repaint the lot */
+        draw_cells(view_x, view_y, view_x + view_cols, view_y + view_rows);
+        return;
     }
 
-    /* Draw status */
-    sprintf(status, "Level: %d/%d  Moves: %d  Pushes: %d",
-            current_level + 1, NUM_LEVELS, moves, pushes);
+    if (dx > 0)
+        draw_cells(view_x + view_cols - dx, view_y, view_x + view_cols, view_y + view_rows);
+    else if (dx < 0)
+        draw_cells(view_x, view_y, view_x - dx, view_y + view_rows);
+    if (dy > 0)
+        draw_cells(view_x, view_y + view_rows - dy, view_x + view_cols, view_y + view_rows);
+    else if (dy < 0)
+        draw_cells(view_x, view_y, view_x + view_cols, view_y - dy);
+}
+
+void draw_status()
+{
+    char status[160];
+
+    pw_rop(pw, 0, 0, WINDOW_WIDTH, STATUS_HEIGHT,
+           PIX_SRC | PIX_COLOR(COLOR_BACKGROUND), NULL, 0, 0);
+    sprintf(status, "Level: %d/%d  Moves: %d  Pushes: %d  Goals: %d/%d  %s",
+            current_level + 1, num_levels, moves, pushes,
+            total_goals - goals_left, total_goals, message);
     pw_text(pw, 30, 25, PIX_SRC | PIX_COLOR(COLOR_TEXT), 0, status);
+}
+
+void draw_game()
+{
+    /* Clear background */
+    pw_rop(pw, 0, 0, WINDOW_WIDTH, WINDOW_HEIGHT,
+           PIX_SRC | PIX_COLOR(COLOR_BACKGROUND), NULL, 0, 0);
+
+    /* Draw the part of the level in view */
+    follow_player(0);
+    draw_cells(view_x, view_y, view_x + view_cols, view_y + view_rows);
+    changed_count = 0;
+    changed_overflow = 0;
+    overlay_count = 0;
 
+    draw_status();
     pw_text(pw, 30, WINDOW_HEIGHT - 20, PIX_SRC | PIX_COLOR(COLOR_TEXT), 0,
-            "WASD/hjkl to move, R to restart, N for next level, Q to quit");
+            "WASD/hjkl move, U undo, Y redo, I hint, X solve, R restart, N next");
+}
+
+/* Remember a cell for the next draw_changes() */
+void mark_changed(x, y)
+int x, y;
+{
+    if (changed_count == MAX_CHANGED) {
+        changed_overflow = 1;
+        return;
+    }
+    changed_x[changed_count] = x;
+    changed_y[changed_count] = y;
+    changed_count++;
+}
+
+/* Repaint only the cells moves have changed, and the status line */
+void draw_changes()
+{
+    int i;
+
+    if (changed_overflow) {
+        draw_game();
+        return;
+    }
+    follow_player(1);
+    for (i = 0; i < changed_count; i++) {
+        draw_cell(changed_x[i], changed_y[i]);
+    }
+    changed_count = 0;
+    draw_status();
 }
 
 int can_move(dx, dy)
@@ -351,6 +978,7 @@ int dx, dy;
     int new_x, new_y, next_x, next_y;
     int cell, next_cell;
     int is_push = 0;
+    char letter;
 
     new_x = player_x + dx;
     new_y = player_y + dy;
@@ -364,12 +992,14 @@ int dx, dy;
         /* Move the box */
         if (cell == BOX_ON_GOAL) {
             game_grid[new_y][new_x] = GOAL;
+            goals_left++;
         } else {
             game_grid[new_y][new_x] = EMPTY;
         }
 
         if (next_cell == GOAL) {
             game_grid[next_y][next_x] = BOX_ON_GOAL;
+            goals_left--;
         } else {
             game_grid[next_y][next_x] = BOX;
         }
@@ -378,33 +1008,230 @@ int dx, dy;
         pushes++;
     }
 
+    mark_changed(player_x, player_y);
+    mark_changed(new_x, new_y);
+    if (is_push) mark_changed(next_x, next_y);
     player_x = new_x;
     player_y = new_y;
+
+    /* Log the move, keeping the redo list if it is the move redo
+       would have made */
+    letter = dir_letter[dy < 0 ? UP : dy > 0 ? DOWN : dx < 0 ? LEFT : RIGHT];
+    if (is_push) letter += 'A' - 'a';
+    if (moves >= log_room) {
+        log_room = log_room ? log_room * 2 : 1024;
+        move_log = (char *)realloc(move_log, log_room);
+        if (move_log == NULL) {
+            fprintf(stderr, "Out of memory for the move log\n");
+            exit(1);
+        }
+    }
+    if (moves >= log_end || move_log[moves] != letter) {
+        move_log[moves] = letter;
+        log_end = moves + 1;
+    }
     moves++;
 
     if (is_push) {
+        check_deadlock(next_y * level_width + next_x);
         check_win();
     }
 }
 
-void check_win()
+/* Direction of a LURD letter; returns 0 if c is not one */
+int letter_step(c, dx, dy)
+int c;
+int *dx, *dy;
 {
-    int x, y, boxes_on_goals = 0, total_goals = 0;
+    *dx = 0;
+    *dy = 0;
+    switch (c) {
+        case 'u': case 'U': *dy = -1; break;
+        case 'd': case 'D': *dy = 1; break;
+        case 'l': case 'L': *dx = -1; break;
+        case 'r': case 'R': *dx = 1; break;
+        default: return 0;
+    }
+    return 1;
+}
 
-    for (y = 0; y < level_height; y++) {
-        for (x = 0; x < level_width; x++) {
-            if (game_grid[y][x] == GOAL)
-                total_goals++;
-            else if (game_grid[y][x] == BOX_ON_GOAL) {
-                boxes_on_goals++;
-                total_goals++;
-            }
+/* Take back the last move, pulling the box back if it was a push */
+void undo_move()
+{
+    int c, dx, dy, box_x, box_y;
+
+    if (moves == 0) return;
+    c = move_log[--moves];
+    letter_step(c, &dx, &dy);
+    mark_changed(player_x, player_y);
+    mark_changed(player_x - dx, player_y - dy);
+    if (c >= 'A' && c <= 'Z') {
+        box_x = player_x + dx;
+        box_y = player_y + dy;
+        mark_changed(box_x, box_y);
+        if (game_grid[box_y][box_x] == BOX_ON_GOAL) {
+            game_grid[box_y][box_x] = GOAL;
+            goals_left++;
+        } else {
+            game_grid[box_y][box_x] = EMPTY;
+        }
+        if (game_grid[player_y][player_x] == GOAL) {
+            game_grid[player_y][player_x] = BOX_ON_GOAL;
+            goals_left--;
+        } else {
+            game_grid[player_y][player_x] = BOX;
+        }
+        pushes--;
+        check_deadlock(player_y * level_width + player_x);
+    }
+    player_x -= dx;
+    player_y -= dy;
+}
+
+/* Pull a box away from every goal at once.  Each pull needs the cell
+   the box moves to and the one behind it for the player; floor never
+   reached this way is dead. */
+void find_dead_cells()
+{
+    int area, first, last, c, n, d, x, y;
+
+    area = level_width * level_height;
+    memset(stuck_mark, 0, area);
+    stuck_count = 0;
+    first = 0;
+    last = 0;
+    for (c = 0; c < area; c++) {
+        dead_cell[c] = 1;
+        if (game_grid[0][c] == GOAL || game_grid[0][c] == BOX_ON_GOAL) {
+            dead_cell[c] = 0;
+            walk_queue[last++] = c;
+        }
+    }
+    while (first < last) {
+        c = walk_queue[first++];
+        x = c % level_width;
+        y = c / level_width;
+        for (d = 0; d < 4; d++) {
+            if (x + 2 * step_x[d] < 0 || x + 2 * step_x[d] >= level_width ||
+                y + 2 * step_y[d] < 0 || y + 2 * step_y[d] >= level_height)
+                continue;
+            n = c + step_y[d] * level_width + step_x[d];
+            if (!dead_cell[n] || game_grid[0][n] == WALL ||
+                game_grid[0][n + step_y[d] * level_width + step_x[d]] == WALL)
+                continue;
+            dead_cell[n] = 0;
+            walk_queue[last++] = n;
+        }
+    }
+}
+
+/* Whether the box at c can never move again, as box_frozen() in the
+   solver: stuck along an axis against a wall, between two dead cells
+   or against a stuck box.  c stands in as a wall while its
+   neighbours are checked, which also catches 2x2 blocks.  Boxes found
+   stuck are appended to stuck_cell[].  Returns 0 if it can move, 1 if
+   it is stuck with every box involved on a goal and 2 if not. */
+int box_stuck(c)
+int c;
+{
+    int axis, i, a, b, r, x, y, off, save, cell, blocked[2], side[2];
+
+    x = c % level_width;
+    y = c / level_width;
+    save = stuck_count;
+    cell = game_grid[0][c];
+    off = cell == BOX;
+    game_grid[0][c] = WALL;
+    for (axis = 0; axis < 2; axis++) {
+        for (i = 0; i < 2; i++) {
+            side[i] = -1;
+            if (x + step_x[axis * 2 + i] >= 0 && x + step_x[axis * 2 + i] < level_width &&
+                y + step_y[axis * 2 + i] >= 0 && y + step_y[axis * 2 + i] < level_height)
+                side[i] = c + step_y[axis * 2 + i] * level_width + step_x[axis * 2 + i];
+        }
+        a = side[0];
+        b = side[1];
+        blocked[axis] = 0;
+        if (a < 0 || b < 0 || game_grid[0][a] == WALL || game_grid[0][b] == WALL ||
+            (dead_cell[a] && dead_cell[b])) {
+            blocked[axis] = 1;
+        } else if ((game_grid[0][a] == BOX || game_grid[0][a] == BOX_ON_GOAL) &&
+                   (r = box_stuck(a)) != 0) {
+            blocked[axis] = 1;
+            if (r == 2) off = 1;
+        } else if ((game_grid[0][b] == BOX || game_grid[0][b] == BOX_ON_GOAL) &&
+                   (r = box_stuck(b)) != 0) {
+            blocked[axis] = 1;
+            if (r == 2) off = 1;
+        }
+        if (!blocked[axis]) break;
+    }
+    game_grid[0][c] = cell;
+
+    if (!blocked[0] || !blocked[1]) {
+        stuck_count = save;
+        return 0;
+    }
+    if (stuck_count < grid_room) stuck_cell[stuck_count++] = c;
+    return off ? 2 : 1;
+}
+
+/* Recheck the deadlock after the box at c moved: the boxes of the
+   last one may have been freed, and c may have made a new one */
+void check_deadlock(c)
+int c;
+{
+    int i, n, old, box, save, cell;
+
+    old = stuck_count;
+    for (i = 0; i < old; i++) {
+        stuck_old[i] = stuck_cell[i];
+        stuck_mark[stuck_cell[i]] = 0;
+        mark_changed(stuck_cell[i] % level_width, stuck_cell[i] / level_width);
+    }
+    stuck_old[old++] = c;
+
+    stuck_count = 0;
+    for (i = 0; i < old; i++) {
+        box = stuck_old[i];
+        cell = game_grid[0][box];
+        if ((cell != BOX && cell != BOX_ON_GOAL) || stuck_mark[box]) continue;
+        save = stuck_count;
+        if (cell == BOX && dead_cell[box]) {
+            stuck_cell[stuck_count++] = box;
+        } else if (box_stuck(box) != 2) {
+            stuck_count = save;
+        }
+        for (n = save; n < stuck_count; n++) {
+            stuck_mark[stuck_cell[n]] = 1;
+            mark_changed(stuck_cell[n] % level_width, stuck_cell[n] / level_width);
         }
     }
 
-    if (boxes_on_goals == total_goals && total_goals > 0) {
+    if (stuck_count > 0) {
+        strcpy(message, "Deadlock - U to undo");
+    } else if (strcmp(message, "Deadlock - U to undo") == 0) {
+        message[0] = '\0';
+    }
+}
+
+void redo_move()
+{
+    int dx, dy;
+
+    if (moves >= log_end) return;
+    letter_step(move_log[moves], &dx, &dy);
+    make_move(dx, dy);
+}
+
+void check_win()
+{
+    if (goals_left == 0 && total_goals > 0) {
         /* Level completed */
-        if (current_level < NUM_LEVELS - 1) {
+        level_won = 1;
+        if (headless) return;
+        if (playback == NULL || playback_player) save_solution();
+        if (current_level < num_levels - 1) {
             current_level++;
             init_level();
         }
@@ -419,74 +1246,1917 @@ caddr_t arg;
 {
     unsigned short key_id;
 
+    if (!event_is_ascii(event)) {
+        handle_mouse(event);
+        return;
+    }
     if (event_is_up(event))
         return;
 
     key_id = event_id(event);
 
-    if (event_is_ascii(event)) {
-        switch (key_id) {
-            case 'q':
-            case 'Q':
-                exit(0);
-                break;
-            case 'r':
-            case 'R':
+    if (playback != NULL && key_id != 'q' && key_id != 'Q') {
+        /* Any key interrupts playback */
+        stop_playback();
+        return;
+    }
+    hide_overlay();
+
+    switch (key_id) {
+        case 'q':
+        case 'Q':
+            exit(0);
+            break;
+        case 'r':
+        case 'R':
+            init_level();
+            draw_game();
+            break;
+        case 'n':
+        case 'N':
+            if (current_level < num_levels - 1) {
+                current_level++;
                 init_level();
                 draw_game();
-                break;
-            case 'n':
-            case 'N':
-                if (current_level < NUM_LEVELS - 1) {
-                    current_level++;
-                    init_level();
-                    draw_game();
-                }
-                break;
-            case 'p':
-            case 'P':
-                if (current_level > 0) {
-                    current_level--;
-                    init_level();
-                    draw_game();
-                }
-                break;
-            case 'w':
-            case 'W':
-            case 'k':
-            case 'K':
-                if (can_move(0, -1)) {
-                    make_move(0, -1);
-                    draw_game();
-                }
-                break;
-            case 's':
-            case 'S':
-            case 'j':
-            case 'J':
-                if (can_move(0, 1)) {
-                    make_move(0, 1);
-                    draw_game();
-                }
-                break;
-            case 'a':
-            case 'A':
-            case 'h':
-            case 'H':
-                if (can_move(-1, 0)) {
-                    make_move(-1, 0);
-                    draw_game();
-                }
-                break;
-            case 'd':
-            case 'D':
-            case 'l':
-            case 'L':
-                if (can_move(1, 0)) {
-                    make_move(1, 0);
-                    draw_game();
-                }
-                break;
+            }
+            break;
+        case 'p':
+        case 'P':
+            if (current_level > 0) {
+                current_level--;
+                init_level();
+                draw_game();
+            }
+            break;
+        case 'i':
+        case 'I':
+            show_solution(1);
+            break;
+        case 'x':
+        case 'X':
+            show_solution(0);
+            break;
+        case 'u':
+        case 'U':
+            undo_move();
+            draw_changes();
+            break;
+        case 'y':
+        case 'Y':
+            redo_move();
+            draw_changes();
+            break;
+        case 'e':
+        case 'E':
+            save_solution();
+            draw_changes();
+            break;
+        case 'w':
+        case 'W':
+        case 'k':
+        case 'K':
+            if (can_move(0, -1)) {
+                make_move(0, -1);
+                draw_changes();
+            }
+            break;
+        case 's':
+        case 'S':
+        case 'j':
+        case 'J':
+            if (can_move(0, 1)) {
+                make_move(0, 1);
+                draw_changes();
+            }
+            break;
+        case 'a':
+        case 'A':
+        case 'h':
+        case 'H':
+            if (can_move(-1, 0)) {
+                make_move(-1, 0);
+                draw_changes();
+            }
+            break;
+        case 'd':
+        case 'D':
+        case 'l':
+        case 'L':
+            if (can_move(1, 0)) {
+                make_move(1, 0);
+                draw_changes();
+            }
+            break;
+    }
+}
+
+/* Push-optimal solver.  A* over box positions with the player
+   normalized to the lowest-numbered cell it can reach, so positions
+   that differ only by walking are the same node.  The solver works on
+   its own copy of the level, padded with a ring of wall so no step
+   needs a bounds check; cell c is (c % solver_width - 1, c / solver_width - 1)
+   in game_grid. */
+
+int solver_width, solver_cells, solver_boxes, solver_goals;
+int solver_step[4];             /* cell offsets for UP, DOWN, LEFT, RIGHT */
+char *solver_wall;              /* walls, and floor the player can never reach */
+char *solver_goal;
+char *solver_dead;              /* a box here can never reach any goal */
+unsigned short *solver_goal_cell;
+unsigned short *goal_dist;      /* goal_dist[g * solver_cells + c]: pushes from c to goal g */
+unsigned long *zobrist_box, *zobrist_player;
+char *box_here;                 /* box index + 1 for the node being expanded */
+int *reach_mark, reach_stamp;   /* stamp-marked so nothing needs clearing */
+int *reach_queue, *reach_from;
+
+/* Hungarian matching scratch, boxes are rows and goals columns */
+int *match_u, *match_v, *match_p, *match_way, *match_minv;
+char *match_used;
+
+/* Search nodes.  The box cells of node n are node_box[n * solver_boxes]
+   onwards, kept sorted so equal positions compare equal. */
+typedef struct {
+    unsigned long hash;
+    int parent;                 /* node this was pushed from, -1 at the root */
+    int next;                   /* next node in the same hash bucket */
+    unsigned short player;      /* normalized player cell */
+    unsigned short push_from;   /* box cell before the push that made this node */
+    unsigned short g, h;        /* pushes so far, lower bound on pushes left */
+    unsigned char push_dir;
+    unsigned char closed;
+} Node;
+
+typedef struct {
+    int f, h, node;
+} HeapEntry;
+
+Node *nodes;
+unsigned short *node_box;
+int node_count, node_room;
+int *hash_bucket, hash_mask;
+HeapEntry *heap;
+int heap_count, heap_room;
+
+unsigned long solver_random()
+{
+    return ((unsigned long)rand() << 16) ^ (unsigned long)rand() ^
+           ((unsigned long)rand() << 24);
+}
+
+char *solver_alloc(size)
+int size;
+{
+    char *p;
+
+    p = (char *)malloc(size > 0 ? size : 1);
+    if (p == NULL) {
+        fprintf(stderr, "Out of memory in solver\n");
+        exit(1);
+    }
+    return p;
+}
+
+void solver_free()
+{
+    free((char *)solver_wall);
+    free((char *)solver_goal);
+    free((char *)solver_dead);
+    free((char *)solver_goal_cell);
+    free((char *)goal_dist);
+    free((char *)zobrist_box);
+    free((char *)zobrist_player);
+    free((char *)box_here);
+    free((char *)reach_mark);
+    free((char *)reach_queue);
+    free((char *)reach_from);
+    free((char *)match_u);
+    free((char *)match_v);
+    free((char *)match_p);
+    free((char *)match_way);
+    free((char *)match_minv);
+    free((char *)match_used);
+}
+
+/* Flood the cells the player reaches from start without passing
+   walls or boxes.  Returns the count; reach_queue[] holds the cells
+   and reach_from[] the step each was entered by. */
+int flood_reach(start)
+int start;
+{
+    int first, last, c, n, d;
+
+    reach_stamp++;
+    reach_mark[start] = reach_stamp;
+    reach_from[start] = -1;
+    reach_queue[0] = start;
+    first = 0;
+    last = 1;
+    while (first < last) {
+        c = reach_queue[first++];
+        for (d = 0; d < 4; d++) {
+            n = c + solver_step[d];
+            if (solver_wall[n] || box_here[n] || reach_mark[n] == reach_stamp)
+                continue;
+            reach_mark[n] = reach_stamp;
+            reach_from[n] = d;
+            reach_queue[last++] = n;
         }
     }
-}
\ No newline at end of file
+    return last;
+}
+
+int lowest_reach(start)
+int start;
+{
+    int i, count, low;
+
+    count = flood_reach(start);
+    low = start;
+    for (i = 1; i < count; i++) {
+        if (reach_queue[i] < low) low = reach_queue[i];
+    }
+    return low;
+}
+
+/* Minimum-cost assignment of boxes to goals by push distance, the
+   shortest augmenting path form of the Hungarian method.  Returns
+   SOLVER_INF if some box can reach no free goal.  Such pairs are
+   still edges of cost SOLVER_INF, so every column with a finite
+   match_minv[] has a match_way[] to follow. */
+int match_bound(boxes)
+unsigned short *boxes;
+{
+    int i, j, j0, j1, i0, delta, cost, n, m;
+
+    n = solver_boxes;
+    m = solver_goals;
+    for (j = 0; j <= m; j++) {
+        match_v[j] = 0;
+        match_p[j] = 0;
+    }
+    for (i = 0; i <= n; i++) match_u[i] = 0;
+
+    for (i = 1; i <= n; i++) {
+        match_p[0] = i;
+        j0 = 0;
+        for (j = 0; j <= m; j++) {
+            match_minv[j] = MATCH_NONE;
+            match_used[j] = 0;
+        }
+        do {
+            match_used[j0] = 1;
+            i0 = match_p[j0];
+            delta = MATCH_NONE;
+            j1 = 0;
+            for (j = 1; j <= m; j++) {
+                if (match_used[j]) continue;
+                cost = goal_dist[(j - 1) * solver_cells + boxes[i0 - 1]]
+                       - match_u[i0] - match_v[j];
+                if (cost < match_minv[j]) {
+                    match_minv[j] = cost;
+                    match_way[j] = j0;
+                }
+                if (match_minv[j] < delta) {
+                    delta = match_minv[j];
+                    j1 = j;
+                }
+            }
+            if (delta >= SOLVER_INF) return SOLVER_INF;
+            for (j = 0; j <= m; j++) {
+                if (match_used[j]) {
+                    match_u[match_p[j]] += delta;
+                    match_v[j] -= delta;
+                } else {
+                    match_minv[j] -= delta;
+                }
+            }
+            j0 = j1;
+        } while (match_p[j0] != 0);
+        do {
+            j1 = match_way[j0];
+            match_p[j0] = match_p[j1];
+            j0 = j1;
+        } while (j0);
+    }
+
+    cost = 0;
+    for (j = 1; j <= m; j++) {
+        if (match_p[j]) {
+            cost += goal_dist[(j - 1) * solver_cells + boxes[match_p[j] - 1]];
+        }
+    }
+    return cost >= SOLVER_INF ? SOLVER_INF : cost;
+}
+
+/* Whether the box at c can never move again.  A box is stuck along
+   an axis when a wall is beside it, when both sides are dead squares,
+   or when a neighbouring box is itself stuck.  c is treated as a wall
+   while its neighbours are checked so pairs do not recurse forever.
+   Returns 0 if it can move, 1 if it is frozen with every box involved
+   on a goal and 2 if a frozen box is off its goal. */
+int box_frozen(c)
+int c;
+{
+    int axis, a, b, r, blocked[2], off;
+
+    off = solver_goal[c] ? 0 : 1;
+    solver_wall[c] = 1;
+    for (axis = 0; axis < 2; axis++) {
+        a = c + solver_step[axis * 2];
+        b = c + solver_step[axis * 2 + 1];
+        blocked[axis] = 0;
+        if (solver_wall[a] || solver_wall[b] ||
+            (solver_dead[a] && solver_dead[b])) {
+            blocked[axis] = 1;
+        } else if (box_here[a] && (r = box_frozen(a)) != 0) {
+            blocked[axis] = 1;
+            if (r == 2) off = 1;
+        } else if (box_here[b] && (r = box_frozen(b)) != 0) {
+            blocked[axis] = 1;
+            if (r == 2) off = 1;
+        }
+        if (!blocked[axis]) break;
+    }
+    solver_wall[c] = 0;
+
+    if (!blocked[0] || !blocked[1]) return 0;
+    return off ? 2 : 1;
+}
+
+void heap_push(f, h, node)
+int f, h, node;
+{
+    int i, parent;
+    HeapEntry e;
+
+    if (heap_count == heap_room) {
+        heap_room *= 2;
+        heap = (HeapEntry *)realloc((char *)heap, heap_room * sizeof(HeapEntry));
+        if (heap == NULL) {
+            fprintf(stderr, "Out of memory in solver\n");
+            exit(1);
+        }
+    }
+    e.f = f;
+    e.h = h;
+    e.node = node;
+    i = heap_count++;
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (heap[parent].f < f || (heap[parent].f == f && heap[parent].h <= h))
+            break;
+        heap[i] = heap[parent];
+        i = parent;
+    }
+    heap[i] = e;
+}
+
+HeapEntry heap_pop()
+{
+    HeapEntry top, last;
+    int i, child;
+
+    top = heap[0];
+    last = heap[--heap_count];
+    i = 0;
+    for (;;) {
+        child = 2 * i + 1;
+        if (child >= heap_count) break;
+        if (child + 1 < heap_count &&
+            (heap[child + 1].f < heap[child].f ||
+             (heap[child + 1].f == heap[child].f && heap[child + 1].h < heap[child].h)))
+            child++;
+        if (last.f < heap[child].f || (last.f == heap[child].f && last.h <= heap[child].h))
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+    return top;
+}
+
+/* Find the node for boxes and player, or add it.  Returns its index;
+   *found tells whether it was already there. */
+int find_node(boxes, player, hash, found)
+unsigned short *boxes;
+int player;
+unsigned long hash;
+int *found;
+{
+    int n, i;
+    unsigned short *b;
+
+    for (n = hash_bucket[hash & hash_mask]; n >= 0; n = nodes[n].next) {
+        if (nodes[n].hash != hash || nodes[n].player != player) continue;
+        b = node_box + (long)n * solver_boxes;
+        for (i = 0; i < solver_boxes; i++) {
+            if (b[i] != boxes[i]) break;
+        }
+        if (i == solver_boxes) {
+            *found = 1;
+            return n;
+        }
+    }
+
+    if (node_count == node_room) {
+        node_room *= 2;
+        nodes = (Node *)realloc((char *)nodes, node_room * sizeof(Node));
+        node_box = (unsigned short *)realloc((char *)node_box,
+                    (long)node_room * solver_boxes * sizeof(unsigned short));
+        if (nodes == NULL || node_box == NULL) {
+            fprintf(stderr, "Out of memory in solver\n");
+            exit(1);
+        }
+    }
+    n = node_count++;
+    nodes[n].hash = hash;
+    nodes[n].player = player;
+    nodes[n].closed = 0;
+    nodes[n].next = hash_bucket[hash & hash_mask];
+    hash_bucket[hash & hash_mask] = n;
+    memcpy((char *)(node_box + (long)n * solver_boxes), (char *)boxes,
+           solver_boxes * sizeof(unsigned short));
+    *found = 0;
+    return n;
+}
+
+/* Build the padded level, the dead squares and the push distances
+   from the current game_grid.  Returns the player's cell, or -1 if
+   the box and goal counts differ. */
+int solver_setup()
+{
+    int x, y, c, n, d, g, i, first, last, start;
+    unsigned short *dist;
+
+    solver_width = level_width + 2;
+    solver_cells = solver_width * (level_height + 2);
+    solver_step[UP] = -solver_width;
+    solver_step[DOWN] = solver_width;
+    solver_step[LEFT] = -1;
+    solver_step[RIGHT] = 1;
+
+    solver_wall = solver_alloc(solver_cells);
+    solver_goal = solver_alloc(solver_cells);
+    solver_dead = solver_alloc(solver_cells);
+    box_here = solver_alloc(solver_cells);
+    reach_mark = (int *)solver_alloc(solver_cells * sizeof(int));
+    reach_queue = (int *)solver_alloc(solver_cells * sizeof(int));
+    reach_from = (int *)solver_alloc(solver_cells * sizeof(int));
+    zobrist_box = (unsigned long *)solver_alloc(solver_cells * sizeof(unsigned long));
+    zobrist_player = (unsigned long *)solver_alloc(solver_cells * sizeof(unsigned long));
+    memset(solver_goal, 0, solver_cells);
+    memset(box_here, 0, solver_cells);
+    memset((char *)reach_mark, 0, solver_cells * sizeof(int));
+    reach_stamp = 0;
+
+    /* Everything the player cannot walk to, ignoring boxes, is wall */
+    memset(solver_wall, 0, solver_cells);
+    for (c = 0; c < solver_cells; c++) {
+        x = c % solver_width - 1;
+        y = c / solver_width - 1;
+        if (x < 0 || y < 0 || x >= level_width || y >= level_height ||
+            game_grid[y][x] == WALL)
+            solver_wall[c] = 1;
+    }
+    start = (player_y + 1) * solver_width + player_x + 1;
+    flood_reach(start);
+    for (c = 0; c < solver_cells; c++) {
+        if (reach_mark[c] != reach_stamp) solver_wall[c] = 1;
+        zobrist_box[c] = solver_random();
+        zobrist_player[c] = solver_random();
+    }
+
+    solver_boxes = 0;
+    solver_goals = 0;
+    for (c = 0; c < solver_cells; c++) {
+        if (solver_wall[c]) continue;
+        x = c % solver_width - 1;
+        y = c / solver_width - 1;
+        if (game_grid[y][x] == GOAL || game_grid[y][x] == BOX_ON_GOAL) {
+            solver_goal[c] = 1;
+            solver_goals++;
+        }
+        if (game_grid[y][x] == BOX || game_grid[y][x] == BOX_ON_GOAL)
+            solver_boxes++;
+    }
+
+    solver_goal_cell = (unsigned short *)solver_alloc(solver_goals * sizeof(unsigned short));
+    goal_dist = (unsigned short *)solver_alloc(solver_goals * solver_cells *
+                                               sizeof(unsigned short));
+    match_u = (int *)solver_alloc((solver_boxes + 1) * sizeof(int));
+    match_v = (int *)solver_alloc((solver_goals + 1) * sizeof(int));
+    match_p = (int *)solver_alloc((solver_goals + 1) * sizeof(int));
+    match_way = (int *)solver_alloc((solver_goals + 1) * sizeof(int));
+    match_minv = (int *)solver_alloc((solver_goals + 1) * sizeof(int));
+    match_used = solver_alloc(solver_goals + 1);
+
+    /* Pull a box away from each goal to find how many pushes bring
+       it back from every cell; a cell no goal reaches is dead */
+    memset(solver_dead, 1, solver_cells);
+    g = 0;
+    for (c = 0; c < solver_cells; c++) {
+        if (!solver_goal[c]) continue;
+        solver_goal_cell[g] = c;
+        dist = goal_dist + g * solver_cells;
+        for (i = 0; i < solver_cells; i++) dist[i] = SOLVER_INF;
+        dist[c] = 0;
+        reach_queue[0] = c;
+        first = 0;
+        last = 1;
+        while (first < last) {
+            i = reach_queue[first++];
+            solver_dead[i] = 0;
+            for (d = 0; d < 4; d++) {
+                n = i + solver_step[d];
+                if (solver_wall[n] || solver_wall[n + solver_step[d]] ||
+                    dist[n] != SOLVER_INF)
+                    continue;
+                dist[n] = dist[i] + 1;
+                reach_queue[last++] = n;
+            }
+        }
+        g++;
+    }
+
+    if (solver_boxes != solver_goals || solver_boxes == 0) return -1;
+    return start;
+}
+
+/* Turn the pushes leading to node goal into LURD moves, walking the
+   player between pushes by shortest path */
+char *solution_moves(goal, start_boxes, start)
+int goal;
+unsigned short *start_boxes;
+int start;
+{
+    int n, i, count, player, c, d, len;
+    int *push;
+    char *moves_out, *walk;
+
+    count = nodes[goal].g;
+    push = (int *)solver_alloc((count + 1) * sizeof(int));
+    for (n = goal, i = count; nodes[n].parent >= 0; n = nodes[n].parent) {
+        push[--i] = n;
+    }
+
+    walk = solver_alloc(solver_cells + 1);
+    moves_out = solver_alloc(count * (solver_cells + 1) + 1);
+    len = 0;
+    memset(box_here, 0, solver_cells);
+    for (i = 0; i < solver_boxes; i++) box_here[start_boxes[i]] = i + 1;
+    player = start;
+
+    for (i = 0; i < count; i++) {
+        n = push[i];
+        d = nodes[n].push_dir;
+        c = nodes[n].push_from;
+
+        /* Walk back from the pushing cell to the player */
+        flood_reach(player);
+        n = 0;
+        for (c = c - solver_step[d]; c != player; c -= solver_step[reach_from[c]]) {
+            walk[n++] = dir_letter[reach_from[c]];
+        }
+        while (n > 0) moves_out[len++] = walk[--n];
+
+        c = nodes[push[i]].push_from;
+        moves_out[len++] = dir_letter[d] - 'a' + 'A';
+        box_here[c + solver_step[d]] = box_here[c];
+        box_here[c] = 0;
+        player = c;
+    }
+    moves_out[len] = '\0';
+    free((char *)walk);
+    free((char *)push);
+    return moves_out;
+}
+
+/* Solve the level as it stands in game_grid with the player at
+   player_x, player_y.  Returns the number of pushes and sets
+   *solution to the LURD moves (lower case walks, upper case pushes),
+   or returns -1 if there is no solution within solver_limit nodes. */
+int solve_level(solution)
+char **solution;
+{
+    int start, root, n, i, j, b, d, c, to, found, h, child, result, buckets;
+    int x, y;
+    int count, player, *candidate;
+    unsigned short *boxes, *child_boxes, tmp;
+    unsigned long box_hash;
+    HeapEntry top;
+
+    *solution = NULL;
+    solver_expanded = 0;
+    if (total_boxes != total_goals || total_goals == 0) return -1;
+    if ((level_width + 2) * (level_height + 2) > SOLVER_CELLS) return -1;
+    if (goals_left == 0) {
+        *solution = solver_alloc(1);
+        **solution = '\0';
+        return 0;
+    }
+    start = solver_setup();
+    if (start < 0) {
+        solver_free();
+        return -1;
+    }
+
+    for (buckets = 1024; buckets < solver_limit / 2 && buckets < (1 << 22); buckets *= 2)
+        ;
+    hash_mask = buckets - 1;
+    hash_bucket = (int *)solver_alloc(buckets * sizeof(int));
+    for (i = 0; i < buckets; i++) hash_bucket[i] = -1;
+    node_room = 1024;
+    node_count = 0;
+    nodes = (Node *)solver_alloc(node_room * sizeof(Node));
+    node_box = (unsigned short *)solver_alloc(node_room * solver_boxes *
+                                              sizeof(unsigned short));
+    heap_room = 1024;
+    heap_count = 0;
+    heap = (HeapEntry *)solver_alloc(heap_room * sizeof(HeapEntry));
+    child_boxes = (unsigned short *)solver_alloc(solver_boxes * sizeof(unsigned short));
+    candidate = (int *)solver_alloc(4 * solver_boxes * sizeof(int));
+
+    /* Root node: box cells in increasing order */
+    b = 0;
+    box_hash = 0;
+    for (c = 0; c < solver_cells; c++) {
+        if (solver_wall[c]) continue;
+        x = c % solver_width - 1;
+        y = c / solver_width - 1;
+        if (game_grid[y][x] == BOX || game_grid[y][x] == BOX_ON_GOAL) {
+            child_boxes[b++] = c;
+            box_hash ^= zobrist_box[c];
+        }
+    }
+    for (i = 0; i < solver_boxes; i++) box_here[child_boxes[i]] = 1;
+    c = lowest_reach(start);
+    for (i = 0; i < solver_boxes; i++) box_here[child_boxes[i]] = 0;
+    root = find_node(child_boxes, c, box_hash ^ zobrist_player[c], &found);
+    h = match_bound(child_boxes);
+    nodes[root].parent = -1;
+    nodes[root].g = 0;
+    nodes[root].h = h;
+    result = -1;
+    if (h < SOLVER_INF) heap_push(h, h, root);
+
+    while (heap_count > 0) {
+        top = heap_pop();
+        n = top.node;
+        if (nodes[n].closed || top.f != nodes[n].g + nodes[n].h) continue;
+        if (nodes[n].h == 0) {
+            result = n;
+            break;
+        }
+        nodes[n].closed = 1;
+        if (++solver_expanded > solver_limit) break;
+
+        /* List the pushes open to the player before the flood is
+           reused to normalize each child */
+        boxes = node_box + (long)n * solver_boxes;
+        for (b = 0; b < solver_boxes; b++) box_here[boxes[b]] = b + 1;
+        flood_reach(nodes[n].player);
+        count = 0;
+        for (b = 0; b < solver_boxes; b++) {
+            c = boxes[b];
+            for (d = 0; d < 4; d++) {
+                to = c + solver_step[d];
+                if (reach_mark[c - solver_step[d]] == reach_stamp &&
+                    !solver_wall[to] && !box_here[to] && !solver_dead[to])
+                    candidate[count++] = b * 4 + d;
+            }
+        }
+
+        box_hash = nodes[n].hash ^ zobrist_player[nodes[n].player];
+        for (i = 0; i < count; i++) {
+            boxes = node_box + (long)n * solver_boxes;
+            b = candidate[i] / 4;
+            d = candidate[i] % 4;
+            c = boxes[b];
+            to = c + solver_step[d];
+
+            /* Push the box and drop the child if that froze it off a goal */
+            box_here[to] = box_here[c];
+            box_here[c] = 0;
+            if (box_frozen(to) == 2) {
+                box_here[c] = box_here[to];
+                box_here[to] = 0;
+                continue;
+            }
+            player = lowest_reach(c);
+            box_here[c] = box_here[to];
+            box_here[to] = 0;
+
+            memcpy((char *)child_boxes, (char *)boxes,
+                   solver_boxes * sizeof(unsigned short));
+            child_boxes[b] = to;
+            for (j = b; j > 0 && child_boxes[j - 1] > child_boxes[j]; j--) {
+                tmp = child_boxes[j];
+                child_boxes[j] = child_boxes[j - 1];
+                child_boxes[j - 1] = tmp;
+            }
+            for (j = b; j < solver_boxes - 1 && child_boxes[j + 1] < child_boxes[j]; j++) {
+                tmp = child_boxes[j];
+                child_boxes[j] = child_boxes[j + 1];
+                child_boxes[j + 1] = tmp;
+            }
+
+            child = find_node(child_boxes, player,
+                              box_hash ^ zobrist_box[c] ^ zobrist_box[to] ^
+                              zobrist_player[player], &found);
+            if (found && (nodes[child].closed || nodes[child].g <= nodes[n].g + 1))
+                continue;
+            if (!found) nodes[child].h = match_bound(child_boxes);
+            nodes[child].parent = n;
+            nodes[child].g = nodes[n].g + 1;
+            nodes[child].push_from = c;
+            nodes[child].push_dir = d;
+            if (nodes[child].h < SOLVER_INF)
+                heap_push(nodes[child].g + nodes[child].h, nodes[child].h, child);
+        }
+        boxes = node_box + (long)n * solver_boxes;
+        for (b = 0; b < solver_boxes; b++) box_here[boxes[b]] = 0;
+    }
+
+    if (result >= 0) {
+        *solution = solution_moves(result, node_box, start);
+        result = nodes[result].g;
+    }
+    free((char *)child_boxes);
+    free((char *)candidate);
+    free((char *)nodes);
+    free((char *)node_box);
+    free((char *)hash_bucket);
+    free((char *)heap);
+    solver_free();
+    return result;
+}
+
+/* Solve from the current position and play the moves back, only up
+   to the next push for a hint */
+void show_solution(hint)
+int hint;
+{
+    char *solution;
+    int n;
+
+    pw_text(pw, 30, WINDOW_HEIGHT - 40, PIX_SRC | PIX_COLOR(COLOR_TEXT), 0,
+            "Solving...");
+    n = solve_level(&solution);
+    if (n < 0) {
+        strcpy(message, "No solution from here");
+    } else {
+        sprintf(message, "%d pushes to go", n);
+        start_playback(solution, hint, PLAY_RATE, 0);
+    }
+    draw_game();
+}
+
+/* Play back the LURD moves in a malloc()ed string, which playback
+   frees.  The timer runs at FRAME_RATE and each tick makes as many
+   moves as rate calls for before redrawing once, so fast replays do
+   not redraw more often than the screen can show.  Only a level won
+   by the player's own moves is saved to SOLUTION_FILE. */
+void start_playback(solution, hint, rate, player)
+char *solution;
+int hint, rate, player;
+{
+    struct itimerval timer;
+
+    stop_playback();
+    if (solution[0] == '\0') {
+        free(solution);
+        return;
+    }
+    playback = solution;
+    playback_pos = 0;
+    playback_hint = hint;
+    playback_rate = rate;
+    playback_player = player;
+    playback_credit = FRAME_RATE;   /* the first move comes on the first tick */
+    timer.it_value.tv_sec = 0;
+    timer.it_value.tv_usec = 1000000 / FRAME_RATE;
+    timer.it_interval = timer.it_value;
+    notify_set_itimer_func(frame, play_tick, ITIMER_REAL, &timer, NULL);
+}
+
+void stop_playback()
+{
+    if (playback == NULL) return;
+    notify_set_itimer_func(frame, NOTIFY_FUNC_NULL, ITIMER_REAL, NULL, NULL);
+    free(playback);
+    playback = NULL;
+}
+
+Notify_value play_tick(client, which)
+    Notify_client client;
+    int which;
+{
+    int c, dx, dy, level;
+
+    if (playback == NULL) return NOTIFY_DONE;
+
+    level = current_level;
+    playback_credit += playback_rate;
+    while (playback_credit >= FRAME_RATE) {
+        playback_credit -= FRAME_RATE;
+        c = playback[playback_pos++];
+        if (!letter_step(c, &dx, &dy) || !can_move(dx, dy)) {
+            strcpy(message, "Replay stopped at an illegal move");
+            stop_playback();
+            break;
+        }
+        make_move(dx, dy);
+
+        /* Winning the level has already reset everything */
+        if (playback == NULL || current_level != level) return NOTIFY_DONE;
+        if (playback[playback_pos] == '\0' || (playback_hint && c >= 'A' && c <= 'Z')) {
+            stop_playback();
+            break;
+        }
+    }
+    draw_changes();
+    return NOTIFY_DONE;
+}
+
+/* Append the moves so far to SOLUTION_FILE as "level moves" */
+void save_solution()
+{
+    FILE *fp;
+
+    fp = fopen(SOLUTION_FILE, "a");
+    if (fp == NULL) {
+        strcpy(message, "Cannot write " SOLUTION_FILE);
+        return;
+    }
+    fprintf(fp, "%d %.*s\n", current_level + 1, moves, moves ? move_log : "");
+    fclose(fp);
+    strcpy(message, "Saved to " SOLUTION_FILE);
+}
+
+/* Read the next "level moves" line of a solution file, skipping
+   blank lines and ; comments.  Returns the moves in a malloc()ed
+   string and sets *level, or returns NULL at the end of the file. */
+char *read_solution(fp, level)
+FILE *fp;
+int *level;
+{
+    char *text;
+    int c, len, room;
+
+    while (fscanf(fp, "%d", level) != 1) {
+        /* Not a solution line: skip it */
+        while ((c = getc(fp)) != EOF && c != '\n')
+            ;
+        if (c == EOF) return NULL;
+    }
+
+    room = 256;
+    text = (char *)malloc(room);
+    len = 0;
+    while (text != NULL && (c = getc(fp)) != EOF && c != '\n') {
+        if (c == ' ' || c == '\t' || c == '\r') continue;
+        if (len + 1 >= room) {
+            room *= 2;
+            text = (char *)realloc(text, room);
+            if (text == NULL) break;
+        }
+        text[len++] = c;
+    }
+    if (text == NULL) {
+        fprintf(stderr, "Out of memory reading solutions\n");
+        exit(1);
+    }
+    text[len] = '\0';
+    return text;
+}
+
+/* The last solution for level in the file, or NULL */
+char *find_solution(path, level)
+char *path;
+int level;
+{
+    FILE *fp;
+    char *text, *found;
+    int n;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        perror(path);
+        exit(1);
+    }
+    found = NULL;
+    while ((text = read_solution(fp, &n)) != NULL) {
+        if (n - 1 == level) {
+            if (found != NULL) free(found);
+            found = text;
+        } else {
+            free(text);
+        }
+    }
+    fclose(fp);
+    return found;
+}
+
+/* Replay every solution in a file without the window and report
+   whether each one is legal and solves its level */
+void verify_solutions(path)
+char *path;
+{
+    FILE *fp;
+    char *text, *p;
+    int n, dx, dy, cell, good, total;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        perror(path);
+        exit(1);
+    }
+    headless = 1;
+    good = 0;
+    total = 0;
+    while ((text = read_solution(fp, &n)) != NULL) {
+        total++;
+        if (n < 1 || n > num_levels) {
+            printf("level %d: no such level\n", n);
+            free(text);
+            continue;
+        }
+        current_level = n - 1;
+        init_level();
+        for (p = text; *p != '\0' && !level_won; p++) {
+            if (!letter_step(*p, &dx, &dy) || !can_move(dx, dy)) break;
+            /* A capital letter must push and a small one must not;
+               checked first, as the winning push ends the loop */
+            cell = game_grid[player_y + dy][player_x + dx];
+            if ((*p >= 'A' && *p <= 'Z') != (cell == BOX || cell == BOX_ON_GOAL)) break;
+            make_move(dx, dy);
+        }
+        if (level_won && *p == '\0') {
+            printf("level %d: solved, %d moves, %d pushes\n", n, moves, pushes);
+            good++;
+        } else if (level_won) {
+            printf("level %d: solved after %d moves with moves left over\n", n, moves);
+        } else if (*p != '\0') {
+            printf("level %d: illegal move %d '%c'\n", n, (int)(p - text) + 1, *p);
+        } else {
+            printf("level %d: not solved after %d moves\n", n, moves);
+        }
+        free(text);
+    }
+    fclose(fp);
+    printf("%d of %d solutions verified\n", good, total);
+}
+
+/* Headless solving: every level, or only the one given with -level */
+void solve_levels(only)
+int only;
+{
+    struct timeval start, end;
+    char *solution;
+    int n, first, last;
+    double secs;
+
+    first = only >= 0 ? only : 0;
+    last = only >= 0 ? only : num_levels - 1;
+    for (current_level = first; current_level <= last; current_level++) {
+        init_level();
+        gettimeofday(&start, NULL);
+        n = solve_level(&solution);
+        gettimeofday(&end, NULL);
+        secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+        if (n < 0) {
+            printf("level %d: unsolved, %ld nodes, %.2fs\n",
+                   current_level + 1, solver_expanded, secs);
+            continue;
+        }
+        printf("level %d: %d pushes, %d moves, %ld nodes, %.2fs\n",
+               current_level + 1, n, (int)strlen(solution), solver_expanded, secs);
+        printf("%s\n", solution);
+        free(solution);
+    }
+}
+
+/* Solve every level in a separate process, keeping up to jobs of them
+   running so a free slot always takes the next level.  Each solver
+   gets its own time and memory limit; one that runs out is killed by
+   SIGALRM or fails to allocate, and that is what the report says;
+   one killed by any other signal is reported as a crash.  Prints a
+   CSV line per level in level order. */
+void batch_levels(jobs, seconds, megabytes)
+int jobs, seconds, megabytes;
+{
+    struct timeval start, end, *began;
+    struct rlimit limit;
+    char **result, line[100], *solution, *status;
+    int *pid, *pipe_fd, *slot_level, fd[2];
+    int next, running, slot, n, len, solved, wstatus, child;
+    double secs;
+
+    pid = (int *)malloc(jobs * sizeof(int));
+    pipe_fd = (int *)malloc(jobs * sizeof(int));
+    slot_level = (int *)malloc(jobs * sizeof(int));
+    began = (struct timeval *)malloc(jobs * sizeof(struct timeval));
+    result = (char **)malloc(num_levels * sizeof(char *));
+    if (pid == NULL || pipe_fd == NULL || slot_level == NULL ||
+        began == NULL || result == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    for (slot = 0; slot < jobs; slot++) pid[slot] = 0;
+
+    gettimeofday(&start, NULL);
+    fflush(stdout);
+    next = 0;
+    running = 0;
+    solved = 0;
+    while (next < num_levels || running > 0) {
+        /* Start solvers while there are free slots and levels left */
+        for (slot = 0; slot < jobs && next < num_levels; slot++) {
+            if (pid[slot] != 0) continue;
+            if (pipe(fd) < 0) {
+                perror("pipe");
+                exit(1);
+            }
+            gettimeofday(&began[slot], NULL);
+            child = fork();
+            if (child < 0) {
+                perror("fork");
+                exit(1);
+            }
+            if (child == 0) {
+                close(fd[0]);
+                limit.rlim_cur = limit.rlim_max = (long)megabytes * 1024 * 1024;
+                setrlimit(RLIMIT_DATA, &limit);
+                alarm(seconds);
+                current_level = next;
+                init_level();
+                n = solve_level(&solution);
+                if (n < 0) {
+                    sprintf(line, "unsolved,,,%ld", solver_expanded);
+                } else {
+                    sprintf(line, "solved,%d,%d,%ld", n, (int)strlen(solution),
+                            solver_expanded);
+                }
+                write(fd[1], line, strlen(line));
+                _exit(0);
+            }
+            close(fd[1]);
+            pid[slot] = child;
+            pipe_fd[slot] = fd[0];
+            slot_level[slot] = next++;
+            running++;
+        }
+
+        child = wait(&wstatus);
+        if (child < 0) break;
+        for (slot = 0; slot < jobs && pid[slot] != child; slot++)
+            ;
+        if (slot == jobs) continue;
+
+        gettimeofday(&end, NULL);
+        secs = (end.tv_sec - began[slot].tv_sec) +
+               (end.tv_usec - began[slot].tv_usec) / 1e6;
+        len = read(pipe_fd[slot], line, sizeof(line) - 1);
+        line[len > 0 ? len : 0] = '\0';
+        close(pipe_fd[slot]);
+        if (WIFSIGNALED(wstatus) && WTERMSIG(wstatus) == SIGALRM) {
+            status = "timeout,,,";
+        } else if (WIFSIGNALED(wstatus)) {
+            fprintf(stderr, "Level %d: solver killed by signal %d\n",
+                    slot_level[slot] + 1, WTERMSIG(wstatus));
+            status = "crash,,,";
+        } else if (len <= 0) {
+            /* The solver only exits without a result when it runs
+               out of memory */
+            status = "memory,,,";
+        } else {
+            status = line;
+            if (strncmp(line, "solved", 6) == 0) solved++;
+        }
+        result[slot_level[slot]] = (char *)malloc(strlen(status) + 40);
+        sprintf(result[slot_level[slot]], "%d,%s,%.2f",
+                slot_level[slot] + 1, status, secs);
+        pid[slot] = 0;
+        running--;
+    }
+
+    printf("level,result,pushes,moves,nodes,seconds\n");
+    for (n = 0; n < num_levels; n++) {
+        printf("%s\n", result[n]);
+        free(result[n]);
+    }
+    gettimeofday(&end, NULL);
+    fprintf(stderr, "%d of %d levels solved in %.1fs\n", solved, num_levels,
+            (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6);
+    free((char *)pid);
+    free((char *)pipe_fd);
+    free((char *)slot_level);
+    free((char *)began);
+    free((char *)result);
+}
+
+/* Replay moves from the current position, noting each push in push[]
+   as box cell * 4 + direction.  Returns the number of pushes, or -1
+   at an illegal move. */
+int record_pushes(text, push)
+char *text;
+int *push;
+{
+    int n, dx, dy, before;
+    char *p;
+
+    n = 0;
+    for (p = text; *p != '\0'; p++) {
+        if (!letter_step(*p, &dx, &dy) || !can_move(dx, dy)) return -1;
+        before = pushes;
+        make_move(dx, dy);
+        if (pushes != before)
+            push[n++] = (player_y * level_width + player_x) * 4 +
+                        (dy < 0 ? UP : dy > 0 ? DOWN : dx < 0 ? LEFT : RIGHT);
+    }
+    return n;
+}
+
+/* Make the pushes in push[] from the current position, walking the
+   shortest way to each.  Returns the moves in a malloc()ed string, or
+   NULL if a push cannot be made. */
+char *push_moves(push, n)
+int *push, n;
+{
+    char *text;
+    int i, c, d, dx, dy, len, start, room;
+
+    room = 256;
+    text = (char *)malloc(room);
+    len = 0;
+    for (i = 0; i < n && text != NULL; i++) {
+        if (len + level_width * level_height + 2 > room) {
+            room = 2 * room + level_width * level_height;
+            text = (char *)realloc(text, room);
+            if (text == NULL) break;
+        }
+        c = push[i] / 4;
+        d = push[i] % 4;
+        walk_flood(player_y * level_width + player_x, -1, -1);
+        start = len;
+        len = append_walk(text, len, c - step_y[d] * level_width - step_x[d]);
+        if (len < 0 || (game_grid[0][c] != BOX && game_grid[0][c] != BOX_ON_GOAL)) {
+            free(text);
+            return NULL;
+        }
+        text[len++] = dir_letter[d] + 'A' - 'a';
+        for (; start < len; start++) {
+            letter_step(text[start], &dx, &dy);
+            if (!can_move(dx, dy)) {
+                free(text);
+                return NULL;
+            }
+            make_move(dx, dy);
+        }
+    }
+    if (text == NULL) {
+        fprintf(stderr, "Out of memory optimizing level %d\n", current_level + 1);
+        exit(1);
+    }
+    text[len] = '\0';
+    return text;
+}
+
+/* In an optimizer worker: solve for the fewest pushes taking the
+   boxes from where push[first - 1] leaves them to where push[last - 1]
+   does, with those cells as the goals.  Writes "first moves" to fp if
+   that is no more pushes than the recorded ones. */
+void solve_segment(push, first, last, fp)
+int *push, first, last;
+FILE *fp;
+{
+    char *target, *text, *solution;
+    int c, cell, box, n, area;
+
+    area = level_width * level_height;
+    target = (char *)malloc(area);
+    text = push_moves(push, last);
+    if (target == NULL || text == NULL) return;
+    for (c = 0; c < area; c++)
+        target[c] = game_grid[0][c] == BOX || game_grid[0][c] == BOX_ON_GOAL;
+    free(text);
+    init_level();
+    text = push_moves(push, first);
+    if (text == NULL) return;
+
+    total_goals = 0;
+    total_boxes = 0;
+    goals_left = 0;
+    for (c = 0; c < area; c++) {
+        cell = game_grid[0][c];
+        box = cell == BOX || cell == BOX_ON_GOAL;
+        if (target[c]) {
+            game_grid[0][c] = box ? BOX_ON_GOAL : GOAL;
+            total_goals++;
+            if (!box) goals_left++;
+        } else if (box) {
+            game_grid[0][c] = BOX;
+        } else if (cell == GOAL) {
+            game_grid[0][c] = EMPTY;
+        }
+        if (box) total_boxes++;
+    }
+    n = solve_level(&solution);
+    if (n >= 0 && n <= last - first) fprintf(fp, "%d %s\n", first, solution);
+}
+
+/* Shorten the solutions in a file and print them in the same form.
+   First the walking between pushes is redone by shortest path.  Then
+   windows of the push sequence are solved again from the position
+   before them to the one after, each window in its own process with
+   up to jobs running, and any that save pushes or moves are spliced
+   in.  Windows alternate between two offsets and double in size once
+   neither finds anything, until a whole solution is one window or
+   the level's seconds are used up. */
+void optimize_solutions(path, jobs, seconds)
+char *path;
+int jobs, seconds;
+{
+    struct timeval now;
+    FILE *fp, **out;
+    char *text, *best, *candidate, **found;
+    int *push, *seg_push, *trial, *pid, *slot_segment, *first, *last;
+    int level, count, k, n, i, slot, running, segments, next, window, offset;
+    int idle, improved, wstatus, child, seg, old_moves, old_pushes, best_moves;
+    long deadline;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        perror(path);
+        exit(1);
+    }
+    headless = 1;
+    pid = (int *)malloc(jobs * sizeof(int));
+    slot_segment = (int *)malloc(jobs * sizeof(int));
+    out = (FILE **)malloc(jobs * sizeof(FILE *));
+    if (pid == NULL || slot_segment == NULL || out == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    while ((text = read_solution(fp, &level)) != NULL) {
+        if (level < 1 || level > num_levels) {
+            fprintf(stderr, "level %d: no such level\n", level);
+            free(text);
+            continue;
+        }
+        current_level = level - 1;
+        init_level();
+        n = strlen(text);
+        push = (int *)malloc((n + 1) * sizeof(int));
+        seg_push = (int *)malloc((n + 1) * sizeof(int));
+        trial = (int *)malloc((n + 1) * sizeof(int));
+        first = (int *)malloc((n + 1) * sizeof(int));
+        last = (int *)malloc((n + 1) * sizeof(int));
+        found = (char **)malloc((n + 1) * sizeof(char *));
+        if (push == NULL || seg_push == NULL || trial == NULL ||
+            first == NULL || last == NULL || found == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        count = record_pushes(text, push);
+        if (count < 0 || !level_won) {
+            fprintf(stderr, "level %d: not a solution\n", level);
+            free(text);
+            free((char *)push);
+            free((char *)seg_push);
+            free((char *)trial);
+            free((char *)first);
+            free((char *)last);
+            free((char *)found);
+            continue;
+        }
+        old_moves = n;
+        old_pushes = count;
+        init_level();
+        best = push_moves(push, count);
+        free(text);
+
+        gettimeofday(&now, NULL);
+        deadline = now.tv_sec + seconds;
+        window = OPT_WINDOW;
+        offset = 0;
+        idle = 0;
+        for (slot = 0; slot < jobs; slot++) pid[slot] = 0;
+        while (now.tv_sec < deadline) {
+            /* Cut the pushes into windows and solve them in parallel */
+            segments = 0;
+            for (i = offset; i < count; i += window) {
+                first[segments] = i;
+                last[segments] = i + window < count ? i + window : count;
+                found[segments] = NULL;
+                segments++;
+            }
+            if (offset > 0) {
+                first[segments] = 0;
+                last[segments] = offset < count ? offset : count;
+                found[segments] = NULL;
+                segments++;
+            }
+            fflush(stdout);
+            fflush(stderr);
+            next = 0;
+            running = 0;
+            while (next < segments || running > 0) {
+                for (slot = 0; slot < jobs && next < segments; slot++) {
+                    if (pid[slot] != 0) continue;
+                    gettimeofday(&now, NULL);
+                    if (now.tv_sec >= deadline) {
+                        next = segments;
+                        break;
+                    }
+                    out[slot] = tmpfile();
+                    if (out[slot] == NULL) {
+                        perror("tmpfile");
+                        exit(1);
+                    }
+                    child = fork();
+                    if (child < 0) {
+                        perror("fork");
+                        exit(1);
+                    }
+                    if (child == 0) {
+                        alarm((unsigned)(deadline - now.tv_sec));
+                        init_level();
+                        solve_segment(push, first[next], last[next], out[slot]);
+                        fflush(out[slot]);
+                        _exit(0);
+                    }
+                    pid[slot] = child;
+                    slot_segment[slot] = next++;
+                    running++;
+                }
+                if (running == 0) break;
+
+                child = wait(&wstatus);
+                if (child < 0) break;
+                for (slot = 0; slot < jobs && pid[slot] != child; slot++)
+                    ;
+                if (slot == jobs) continue;
+                rewind(out[slot]);
+                found[slot_segment[slot]] = read_solution(out[slot], &k);
+                fclose(out[slot]);
+                pid[slot] = 0;
+                running--;
+            }
+
+            /* Splice in whatever helped, last window first so the
+               push numbers of the earlier ones still hold */
+            improved = 0;
+            for (seg = segments - 1; seg >= 0; seg--) {
+                if (found[seg] == NULL) continue;
+                init_level();
+                text = push_moves(push, first[seg]);
+                n = text == NULL ? -1 : record_pushes(found[seg], seg_push);
+                free(found[seg]);
+                if (text != NULL) free(text);
+                if (n < 0) continue;
+                for (i = 0; i < first[seg]; i++) trial[i] = push[i];
+                for (i = 0; i < n; i++) trial[first[seg] + i] = seg_push[i];
+                for (i = last[seg]; i < count; i++)
+                    trial[first[seg] + n + i - last[seg]] = push[i];
+                n += count - (last[seg] - first[seg]);
+                init_level();
+                candidate = push_moves(trial, n);
+                if (candidate == NULL) continue;
+                best_moves = strlen(best);
+                if (level_won && (n < count ||
+                                  (n == count && (int)strlen(candidate) < best_moves))) {
+                    free(best);
+                    best = candidate;
+                    for (i = 0; i < n; i++) push[i] = trial[i];
+                    count = n;
+                    improved = 1;
+                } else {
+                    free(candidate);
+                }
+            }
+
+            if (improved) {
+                idle = 0;
+            } else if (++idle >= 2) {
+                if (window >= count) break;
+                window *= 2;
+                idle = 0;
+            }
+            offset = offset == 0 ? window / 2 : 0;
+            gettimeofday(&now, NULL);
+        }
+
+        printf("%d %s\n", level, best);
+        fprintf(stderr, "level %d: %d moves %d pushes -> %d moves %d pushes\n",
+                level, old_moves, old_pushes, (int)strlen(best), count);
+        free(best);
+        free((char *)push);
+        free((char *)seg_push);
+        free((char *)trial);
+        free((char *)first);
+        free((char *)last);
+        free((char *)found);
+    }
+    fclose(fp);
+    free((char *)pid);
+    free((char *)slot_segment);
+    free((char *)out);
+}
+
+/* Make the current level a random room: a rectangle of floor inside
+   walls with wall pieces dropped in, cut down to the part the player
+   can reach.  Returns the number of floor cells. */
+int random_room(level, width, height)
+Level *level;
+int width, height;
+{
+    int area, c, i, k, x, y, floor;
+
+    area = width * height;
+    for (c = 0; c < area; c++) {
+        x = c % width;
+        y = c / width;
+        level->cells[c] = x == 0 || y == 0 || x == width - 1 || y == height - 1 ?
+                          WALL : EMPTY;
+    }
+    for (i = 0; i < area / GEN_PIECES; i++) {
+        x = 1 + rand() % (width - 2);
+        y = 1 + rand() % (height - 2);
+        k = rand() % 4;
+        /* A single block, a pair across or down, or an L */
+        level->cells[y * width + x] = WALL;
+        if ((k == 1 || k == 3) && x + 1 < width) level->cells[y * width + x + 1] = WALL;
+        if ((k == 2 || k == 3) && y + 1 < height) level->cells[(y + 1) * width + x] = WALL;
+    }
+
+    /* Put the player somewhere open and wall off what it cannot reach */
+    do {
+        c = rand() % area;
+    } while (level->cells[c] != EMPTY);
+    level->player_x = c % width;
+    level->player_y = c / width;
+    level->goals = level->boxes = level->goals_left = 0;
+    init_level();
+    floor = walk_flood(c, -1, -1);
+    for (c = 0; c < area; c++) {
+        if (walk_mark[c] != walk_stamp) game_grid[0][c] = WALL;
+    }
+    return floor;
+}
+
+/* Pull boxes away from the goals at random, as a player walking
+   backwards would.  A box next to the player is pulled one cell
+   towards it while the player steps back, so every pull can be
+   undone by a push. */
+void pull_boxes(count)
+int count;
+{
+    int i, n, c, d, p, q, x, y, area, pull;
+
+    area = level_width * level_height;
+    for (i = 0; i < count; i++) {
+        walk_flood(player_y * level_width + player_x, -1, -1);
+        n = 0;
+        for (c = 0; c < area; c++) {
+            if (game_grid[0][c] != BOX && game_grid[0][c] != BOX_ON_GOAL) continue;
+            x = c % level_width;
+            y = c / level_width;
+            for (d = 0; d < 4; d++) {
+                if (x + 2 * step_x[d] < 0 || x + 2 * step_x[d] >= level_width ||
+                    y + 2 * step_y[d] < 0 || y + 2 * step_y[d] >= level_height)
+                    continue;
+                p = c + step_y[d] * level_width + step_x[d];
+                q = p + step_y[d] * level_width + step_x[d];
+                if (walk_mark[p] == walk_stamp && open_cell(q, -1, -1))
+                    push_queue[n++] = c * 4 + d;
+            }
+        }
+        if (n == 0) return;
+        pull = push_queue[rand() % n];
+        c = pull / 4;
+        d = pull % 4;
+        p = c + step_y[d] * level_width + step_x[d];
+        q = p + step_y[d] * level_width + step_x[d];
+        game_grid[0][c] = game_grid[0][c] == BOX_ON_GOAL ? GOAL : EMPTY;
+        game_grid[0][p] = game_grid[0][p] == GOAL ? BOX_ON_GOAL : BOX;
+        player_x = q % level_width;
+        player_y = q / level_width;
+    }
+}
+
+/* In a generator worker: make random levels until one is solvable,
+   has every box off its goal and scores at least difficulty.  The
+   score is the fewest pushes plus one for every GEN_EFFORT positions
+   the solver had to look at.  Writes "score pushes moves nodes" and
+   the board to fp. */
+void generate_level(width, height, boxes, difficulty, fp)
+int width, height, boxes, difficulty;
+FILE *fp;
+{
+    Level *level;
+    char *solution;
+    int area, c, i, n, score, x, y;
+
+    level = &levels[0];
+    area = width * height;
+    level->width = width;
+    level->height = height;
+    level->cells = (char *)malloc(area);
+    if (level->cells == NULL) return;
+    for (;;) {
+        if (random_room(level, width, height) < boxes * 3) continue;
+
+        /* Goals with their boxes on them, then pull the boxes off */
+        for (i = 0; i < boxes; i++) {
+            do {
+                c = rand() % area;
+            } while (game_grid[0][c] != EMPTY || c == player_y * width + player_x);
+            game_grid[0][c] = BOX_ON_GOAL;
+        }
+        pull_boxes(boxes * GEN_PULLS);
+
+        n = 0;
+        for (c = 0; c < area; c++) {
+            level->cells[c] = game_grid[0][c];
+            if (game_grid[0][c] == GOAL) n++;
+        }
+        if (n < boxes) continue;
+        level->player_x = player_x;
+        level->player_y = player_y;
+        level->goals = level->boxes = level->goals_left = boxes;
+        init_level();
+        n = solve_level(&solution);
+        if (n < 0) continue;
+        score = n + solver_expanded / GEN_EFFORT;
+        if (score < difficulty) {
+            free(solution);
+            continue;
+        }
+
+        fprintf(fp, "%d %d %d %ld\n", score, n, (int)strlen(solution), solver_expanded);
+        for (y = 0; y < height; y++) {
+            for (x = 0; x < width; x++) {
+                c = game_grid[y][x];
+                if (x == player_x && y == player_y) c = c == GOAL ? PLAYER_ON_GOAL : PLAYER;
+                putc(c, fp);
+            }
+            putc('\n', fp);
+        }
+        return;
+    }
+}
+
+/* Generate count levels into a pack on stdout.  Each worker process
+   keeps making candidates from its own seed until one passes.  All
+   jobs of them run until count levels are made, even for the last
+   level, and the rest are then killed; a worker out of time is
+   replaced with a fresh seed.  Gives up after GEN_TRIES workers per
+   level. */
+void generate_levels(count, width, height, boxes, difficulty, seed, jobs, seconds, megabytes)
+int count, width, height, boxes, difficulty, seed, jobs, seconds, megabytes;
+{
+    struct rlimit limit;
+    FILE **out;
+    char line[MAX_LEVEL_SIZE + 2];
+    int *pid, made, started, running, slot, child, wstatus, score, pushes_made, len;
+    long nodes;
+
+    if (width < 5 || height < 5 || width > MAX_LEVEL_SIZE || height > MAX_LEVEL_SIZE) {
+        fprintf(stderr, "Level size must be from 5x5 to %dx%d\n",
+                MAX_LEVEL_SIZE, MAX_LEVEL_SIZE);
+        exit(1);
+    }
+    pid = (int *)malloc(jobs * sizeof(int));
+    out = (FILE **)malloc(jobs * sizeof(FILE *));
+    levels = (Level *)malloc(sizeof(Level));
+    if (pid == NULL || out == NULL || levels == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    num_levels = 1;
+    current_level = 0;
+    headless = 1;
+    for (slot = 0; slot < jobs; slot++) pid[slot] = 0;
+
+    fflush(stdout);
+    made = 0;
+    started = 0;
+    running = 0;
+    while (made < count && (started < count * GEN_TRIES || running > 0)) {
+        for (slot = 0; slot < jobs && started < count * GEN_TRIES; slot++) {
+            if (pid[slot] != 0) continue;
+            out[slot] = tmpfile();
+            if (out[slot] == NULL) {
+                perror("tmpfile");
+                exit(1);
+            }
+            child = fork();
+            if (child < 0) {
+                perror("fork");
+                exit(1);
+            }
+            if (child == 0) {
+                limit.rlim_cur = limit.rlim_max = (long)megabytes * 1024 * 1024;
+                setrlimit(RLIMIT_DATA, &limit);
+                alarm(seconds);
+                srand(seed + started);
+                generate_level(width, height, boxes, difficulty, out[slot]);
+                fflush(out[slot]);
+                _exit(0);
+            }
+            pid[slot] = child;
+            started++;
+            running++;
+        }
+        if (running == 0) break;
+
+        child = wait(&wstatus);
+        if (child < 0) break;
+        for (slot = 0; slot < jobs && pid[slot] != child; slot++)
+            ;
+        if (slot == jobs) continue;
+        pid[slot] = 0;
+        running--;
+        rewind(out[slot]);
+        if (made < count &&
+            fscanf(out[slot], "%d %d %d %ld\n", &score, &pushes_made, &len, &nodes) == 4) {
+            made++;
+            printf("; %d\n; score %d: %d pushes, %d moves, %ld nodes\n\n",
+                   made, score, pushes_made, len, nodes);
+            while (fgets(line, sizeof(line), out[slot]) != NULL)
+                fputs(line, stdout);
+            printf("\n");
+            fflush(stdout);
+        }
+        fclose(out[slot]);
+    }
+
+    /* Stop the workers still searching for levels no longer needed */
+    for (slot = 0; slot < jobs; slot++) {
+        if (pid[slot] == 0) continue;
+        kill(pid[slot], SIGKILL);
+        waitpid(pid[slot], &wstatus, 0);
+        fclose(out[slot]);
+    }
+    fprintf(stderr, "%d of %d levels generated from %d workers\n", made, count, started);
+    free((char *)pid);
+    free((char *)out);
+}
+
+/* Whether the player could stand on cell c, with the box at free
+   taken away and one put at block */
+int open_cell(c, free_cell, block_cell)
+int c, free_cell, block_cell;
+{
+    int cell;
+
+    if (c == block_cell) return 0;
+    cell = game_grid[0][c];
+    if (cell == WALL) return 0;
+    if ((cell == BOX || cell == BOX_ON_GOAL) && c != free_cell) return 0;
+    return 1;
+}
+
+/* Flood the cells the player can walk to from start, with the box at
+   free_cell moved to block_cell (-1 for neither).  Reached cells get
+   walk_mark[] == walk_stamp; returns how many there are. */
+int walk_flood(start, free_cell, block_cell)
+int start, free_cell, block_cell;
+{
+    int first, last, c, n, d, x, y;
+
+    walk_stamp++;
+    walk_mark[start] = walk_stamp;
+    walk_from[start] = -1;
+    walk_queue[0] = start;
+    first = 0;
+    last = 1;
+    while (first < last) {
+        c = walk_queue[first++];
+        x = c % level_width;
+        y = c / level_width;
+        for (d = 0; d < 4; d++) {
+            if (x + step_x[d] < 0 || x + step_x[d] >= level_width ||
+                y + step_y[d] < 0 || y + step_y[d] >= level_height)
+                continue;
+            n = c + step_y[d] * level_width + step_x[d];
+            if (walk_mark[n] == walk_stamp || !open_cell(n, free_cell, block_cell))
+                continue;
+            walk_mark[n] = walk_stamp;
+            walk_from[n] = d;
+            walk_queue[last++] = n;
+        }
+    }
+    return last;
+}
+
+/* Append to moves the shortest walk from the last walk_flood() start
+   to target, returning the new length, or -1 if it cannot be reached */
+int append_walk(moves_out, len, target)
+char *moves_out;
+int len, target;
+{
+    int n, c, d;
+
+    if (walk_mark[target] != walk_stamp) return -1;
+    n = 0;
+    for (c = target; walk_from[c] >= 0; c -= step_y[d] * level_width + step_x[d]) {
+        d = walk_from[c];
+        walk_path[n++] = dir_letter[d];
+    }
+    while (n > 0) moves_out[len++] = walk_path[--n];
+    return len;
+}
+
+/* LURD moves walking the player to cell target, or NULL */
+char *walk_moves(target)
+int target;
+{
+    char *moves_out;
+    int len;
+
+    walk_flood(player_y * level_width + player_x, -1, -1);
+    if (walk_mark[target] != walk_stamp || walk_from[target] < 0) return NULL;
+    moves_out = (char *)malloc(level_width * level_height + 1);
+    if (moves_out == NULL) return NULL;
+    len = append_walk(moves_out, 0, target);
+    moves_out[len] = '\0';
+    return moves_out;
+}
+
+/* Breadth-first search over the positions of one box.  State c * 4 + d
+   has the box at c and the player behind it at c - step d, so each
+   step is one push.  Marks target_state[] for every cell the box can
+   be pushed to and returns how many there are. */
+int push_search(box)
+int box;
+{
+    int first, last, s, c, d, d2, to, player, count, x, y;
+
+    push_stamp++;
+    first = 0;
+    last = 0;
+    count = 0;
+
+    /* Start from every side of the box the player can get to */
+    x = box % level_width;
+    y = box / level_width;
+    walk_flood(player_y * level_width + player_x, -1, -1);
+    for (d = 0; d < 4; d++) {
+        if (x - step_x[d] < 0 || x - step_x[d] >= level_width ||
+            y - step_y[d] < 0 || y - step_y[d] >= level_height)
+            continue;
+        player = box - step_y[d] * level_width - step_x[d];
+        if (walk_mark[player] != walk_stamp) continue;
+        s = box * 4 + d;
+        push_mark[s] = push_stamp;
+        push_prev[s] = -1;
+        push_queue[last++] = s;
+    }
+
+    while (first < last) {
+        s = push_queue[first++];
+        c = s / 4;
+        x = c % level_width;
+        y = c / level_width;
+        walk_flood(c - step_y[s % 4] * level_width - step_x[s % 4], box, c);
+        for (d2 = 0; d2 < 4; d2++) {
+            if (x - step_x[d2] < 0 || x - step_x[d2] >= level_width ||
+                y - step_y[d2] < 0 || y - step_y[d2] >= level_height ||
+                x + step_x[d2] < 0 || x + step_x[d2] >= level_width ||
+                y + step_y[d2] < 0 || y + step_y[d2] >= level_height)
+                continue;
+            player = c - step_y[d2] * level_width - step_x[d2];
+            to = c + step_y[d2] * level_width + step_x[d2];
+            if (walk_mark[player] != walk_stamp || !open_cell(to, box, -1) ||
+                push_mark[to * 4 + d2] == push_stamp)
+                continue;
+            push_mark[to * 4 + d2] = push_stamp;
+            push_prev[to * 4 + d2] = s;
+            push_queue[last++] = to * 4 + d2;
+            if (to != box && target_state[to] < 0) {
+                target_state[to] = to * 4 + d2;
+                overlay_cell[count++] = to;
+            }
+        }
+    }
+    return count;
+}
+
+/* LURD moves pushing box to target along the fewest pushes, walking
+   between them.  push_search(box) must have been run. */
+char *drag_moves(box, target)
+int box, target;
+{
+    int *chain, n, i, s, c, d, len, player;
+    char *moves_out;
+
+    if (target_state[target] < 0) return NULL;
+    n = 0;
+    for (s = target_state[target]; push_prev[s] >= 0; s = push_prev[s]) n++;
+    chain = (int *)malloc(n * sizeof(int));
+    moves_out = (char *)malloc(n * (level_width * level_height + 1) + 1);
+    if (chain == NULL || moves_out == NULL) return NULL;
+    for (i = n, s = target_state[target]; push_prev[s] >= 0; s = push_prev[s])
+        chain[--i] = s;
+
+    len = 0;
+    player = player_y * level_width + player_x;
+    c = box;
+    for (i = 0; i < n; i++) {
+        d = chain[i] % 4;
+        walk_flood(player, box, c);
+        len = append_walk(moves_out, len, c - step_y[d] * level_width - step_x[d]);
+        moves_out[len++] = dir_letter[d] + 'A' - 'a';
+        player = c;
+        c = chain[i] / 4;
+    }
+    moves_out[len] = '\0';
+    free((char *)chain);
+    return moves_out;
+}
+
+/* Dot the cells in overlay_cell[] */
+void show_overlay(color)
+int color;
+{
+    int i, x, y;
+
+    for (i = 0; i < overlay_count; i++) {
+        x = overlay_cell[i] % level_width - view_x;
+        y = overlay_cell[i] / level_width - view_y;
+        if (x < 0 || x >= view_cols || y < 0 || y >= view_rows) continue;
+        pw_rop(pw, x * CELL_SIZE + BOARD_X + CELL_SIZE/2 - 2,
+               y * CELL_SIZE + BOARD_Y + CELL_SIZE/2 - 2, 4, 4,
+               PIX_SRC | PIX_COLOR(color), NULL, 0, 0);
+    }
+}
+
+void hide_overlay()
+{
+    int i;
+
+    for (i = 0; i < overlay_count; i++) {
+        draw_cell(overlay_cell[i] % level_width, overlay_cell[i] / level_width);
+    }
+    overlay_count = 0;
+}
+
+/* Pointer on the board: show where the player can walk.  Click a
+   floor cell to walk there; press on a box to see where it can go
+   and release over one of those cells to push it there. */
+void handle_mouse(event)
+Event *event;
+{
+    int x, y, c, i, count;
+    char *moves_out;
+
+    x = event_x(event) - BOARD_X;
+    y = event_y(event) - BOARD_Y;
+    c = -1;
+    if (x >= 0 && y >= 0 && x / CELL_SIZE < view_cols && y / CELL_SIZE < view_rows)
+        c = (y / CELL_SIZE + view_y) * level_width + x / CELL_SIZE + view_x;
+
+    if (event_action(event) == LOC_WINEXIT) {
+        hide_overlay();
+        drag_box = -1;
+        press_cell = -1;
+        return;
+    }
+    if (playback != NULL) return;
+
+    if (event_action(event) == MS_LEFT && event_is_down(event)) {
+        hide_overlay();
+        press_cell = c;
+        if (c >= 0 && (game_grid[0][c] == BOX || game_grid[0][c] == BOX_ON_GOAL)) {
+            drag_box = c;
+            for (i = 0; i < level_width * level_height; i++) target_state[i] = -1;
+            overlay_count = push_search(c);
+            show_overlay(COLOR_BOX_ON_TARGET);
+        }
+        return;
+    }
+
+    if (event_action(event) == MS_LEFT && event_is_up(event)) {
+        moves_out = NULL;
+        if (drag_box >= 0 && c >= 0) {
+            moves_out = drag_moves(drag_box, c);
+        } else if (drag_box < 0 && c >= 0 && c == press_cell) {
+            moves_out = walk_moves(c);
+        }
+        hide_overlay();
+        drag_box = -1;
+        press_cell = -1;
+        if (moves_out != NULL) start_playback(moves_out, 0, WALK_RATE, 1);
+        return;
+    }
+
+    if (event_action(event) == LOC_MOVE && drag_box < 0 && overlay_count == 0 && c >= 0) {
+        /* Show the reachable area until the next move or key */
+        count = walk_flood(player_y * level_width + player_x, -1, -1);
+        for (i = 1; i < count; i++) overlay_cell[i - 1] = walk_queue[i];
+        overlay_count = count - 1;
+        show_overlay(COLOR_PLAYER);
+    }
+}